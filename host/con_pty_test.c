@@ -0,0 +1,165 @@
+// Хостовая проверка кадрирования консоли (main/con_proto.c) через pty: кадры идут
+// вперемешку с текстом журнала, порциями произвольного размера, с ошибками CRC и длины.
+
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "con_proto.h"
+#include "test_util.h"
+
+#define MAX_FRAMES 16
+
+typedef struct {
+    int ok;
+    int crc_err;
+    uint8_t cmd[MAX_FRAMES];
+    uint8_t len[MAX_FRAMES];
+    uint8_t payload[MAX_FRAMES][CON_MAX_PAYLOAD];
+} rx_result_t;
+
+static int s_master = -1;
+static int s_slave = -1;
+static con_parser_t s_parser;
+
+static void write_all(const uint8_t *buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = write(s_master, buf, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return;
+        buf += w;
+        n -= (size_t)w;
+    }
+}
+
+// Чтение ровно n байт со стороны устройства и разбор, как в console_task
+static void read_feed(size_t n, rx_result_t *res)
+{
+    uint8_t rx[64];
+    while (n > 0) {
+        struct pollfd pfd = { .fd = s_slave, .events = POLLIN };
+        if (poll(&pfd, 1, 1000) <= 0) {
+            expect(0, "pty read timeout");
+            return;
+        }
+        ssize_t r = read(s_slave, rx, n < sizeof(rx) ? n : sizeof(rx));
+        if (r <= 0) continue;
+        n -= (size_t)r;
+        for (ssize_t i = 0; i < r; ++i) {
+            int f = con_parser_feed(&s_parser, rx[i]);
+            if (f > 0 && res->ok < MAX_FRAMES) {
+                res->cmd[res->ok] = s_parser.cmd;
+                res->len[res->ok] = s_parser.len;
+                memcpy(res->payload[res->ok], s_parser.payload, s_parser.len);
+                res->ok++;
+            } else if (f < 0) {
+                res->crc_err++;
+            }
+        }
+    }
+}
+
+static void send_chunked(const uint8_t *buf, size_t n, size_t chunk, rx_result_t *res)
+{
+    for (size_t off = 0; off < n; off += chunk) {
+        size_t c = (n - off < chunk) ? n - off : chunk;
+        write_all(buf + off, c);
+        read_feed(c, res);
+    }
+}
+
+static void check_crc(void)
+{
+    // контрольное значение CRC-16/CCITT-FALSE
+    expect(con_crc16(0xFFFF, (const uint8_t *)"123456789", 9) == 0x29B1, "crc check value");
+}
+
+static void check_mixed_stream(size_t chunk)
+{
+    uint8_t stream[512];
+    size_t n = 0;
+    uint8_t set[CON_SET_LEN];
+    for (int i = 0; i < CON_SET_LEN; ++i) set[i] = (uint8_t)(i * 7 + 1);
+    uint8_t status[CON_STATUS_LEN];
+    for (int i = 0; i < CON_STATUS_LEN; ++i) status[i] = (uint8_t)(0xA5 ^ i); // синхробайты внутри данных
+    static const char log_line[] = "I (1234) sig_gen: Set rpm=60.000 \xA5 noise\n";
+
+    memcpy(&stream[n], log_line, sizeof(log_line) - 1);
+    n += sizeof(log_line) - 1;
+    n += con_frame_build(&stream[n], CON_CMD_PING, NULL, 0);
+    memcpy(&stream[n], log_line, sizeof(log_line) - 1);
+    n += sizeof(log_line) - 1;
+    n += con_frame_build(&stream[n], CON_CMD_SET, set, sizeof(set));
+
+    // кадр с испорченной CRC
+    n += con_frame_build(&stream[n], CON_CMD_STATUS, NULL, 0);
+    stream[n - 1] ^= 0x01;
+
+    // длина вне протокола: не кадр, разбор ищет синхробайты дальше
+    stream[n++] = CON_SYNC0;
+    stream[n++] = CON_SYNC1;
+    stream[n++] = CON_CMD_SET;
+    stream[n++] = CON_MAX_PAYLOAD + 1;
+
+    // повторный первый синхробайт перед кадром
+    stream[n++] = CON_SYNC0;
+    n += con_frame_build(&stream[n], CON_CMD_STATUS | CON_RSP_FLAG, status, sizeof(status));
+
+    rx_result_t res = { 0 };
+    memset(&s_parser, 0, sizeof(s_parser));
+    send_chunked(stream, n, chunk, &res);
+
+    expect(res.ok == 3, "three good frames");
+    expect(res.crc_err == 1, "one crc error");
+    expect(res.cmd[0] == CON_CMD_PING && res.len[0] == 0, "ping frame");
+    expect(res.cmd[1] == CON_CMD_SET && res.len[1] == CON_SET_LEN && memcmp(res.payload[1], set, sizeof(set)) == 0,
+           "set frame payload");
+    expect(res.cmd[2] == (CON_CMD_STATUS | CON_RSP_FLAG) && res.len[2] == CON_STATUS_LEN &&
+           memcmp(res.payload[2], status, sizeof(status)) == 0, "status frame payload");
+}
+
+static void check_max_payload(void)
+{
+    uint8_t payload[CON_MAX_PAYLOAD];
+    for (int i = 0; i < CON_MAX_PAYLOAD; ++i) payload[i] = (uint8_t)(255 - i);
+    uint8_t frame[CON_MAX_PAYLOAD + CON_FRAME_OVERHEAD];
+    size_t n = con_frame_build(frame, CON_CMD_STREAM, payload, sizeof(payload));
+    expect(n == sizeof(frame), "max frame size");
+
+    rx_result_t res = { 0 };
+    memset(&s_parser, 0, sizeof(s_parser));
+    send_chunked(frame, n, n, &res);
+    expect(res.ok == 1 && res.len[0] == CON_MAX_PAYLOAD && memcmp(res.payload[0], payload, sizeof(payload)) == 0,
+           "max payload frame");
+    expect(con_get_u32(&payload[0]) == 0xFCFDFEFFu, "u32 little-endian");
+}
+
+int main(void)
+{
+    if (openpty(&s_master, &s_slave, NULL, NULL, NULL) != 0) {
+        perror("openpty");
+        return 1;
+    }
+    // сырой режим: байты проходят без обработки строк и эха
+    struct termios tio;
+    tcgetattr(s_slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(s_slave, TCSANOW, &tio);
+
+    check_crc();
+    check_mixed_stream(1);
+    check_mixed_stream(7);
+    check_mixed_stream(4096);
+    check_max_payload();
+
+    close(s_master);
+    close(s_slave);
+    if (s_failures) return 1;
+    printf("con_pty_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Хостовая сборка интерпретатора секвенсора: проверка вывода и замер пропускной
+// способности (символов/с). Блоки того же размера, что и на устройстве.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "seq_vm.h"
+#include "test_util.h"
+
+#define CHUNK_SYMBOLS 256 // как SEQ_CHUNK_SYMBOLS в main.c
+#define BENCH_NS 500000000LL // длительность замера одной программы
+
+#define INSN(op, n, a, d0, d1) { (uint8_t)(op), (uint8_t)(n), (uint16_t)(a), (uint32_t)(d0), (uint32_t)(d1) }
+
+// 60-2: 58 зубьев и пропуск двух, 60000 мкс на оборот
+static const seq_insn_t prog_60_2[] = {
+    INSN(SEQ_OP_LOOP, 0, 0, 58, 0),
+    INSN(SEQ_OP_TOOTH, 0, 0, 500, 500),
+    INSN(SEQ_OP_NEXT, 0, 0, 0, 0),
+    INSN(SEQ_OP_LOW, 0, 0, 2000, 0),
+};
+
+// 36 зубьев, на каждом 4-м обороте пропускается зуб 7
+static const seq_insn_t prog_fault[] = {
+    INSN(SEQ_OP_LOOP, 0, 0, 36, 0),
+    INSN(SEQ_OP_WHEN_REV, 2, 4, 0, 0),
+    INSN(SEQ_OP_WHEN_TOOTH, 1, 7, 0, 0),
+    INSN(SEQ_OP_DROP, 0, 0, 0, 0),
+    INSN(SEQ_OP_TOOTH, 0, 0, 100, 177),
+    INSN(SEQ_OP_NEXT, 0, 0, 0, 0),
+};
+
+// Длинные сегменты, которые режутся на куски по 15 бит
+static const seq_insn_t prog_long[] = {
+    INSN(SEQ_OP_HIGH, 0, 0, 100000, 0),
+    INSN(SEQ_OP_LOW, 0, 0, 900000, 0),
+};
+
+// 1000 оборотов 60-2 и останов
+static const seq_insn_t prog_halt[] = {
+    INSN(SEQ_OP_LOOP, 0, 0, 1000, 0),
+    INSN(SEQ_OP_LOOP, 0, 0, 58, 0),
+    INSN(SEQ_OP_TOOTH, 0, 0, 500, 500),
+    INSN(SEQ_OP_NEXT, 0, 0, 0, 0),
+    INSN(SEQ_OP_LOW, 0, 0, 2000, 0),
+    INSN(SEQ_OP_NEXT, 0, 0, 0, 0),
+    INSN(SEQ_OP_HALT, 0, 0, 0, 0),
+};
+
+// Пустой цикл перед выводом: программа не выдает символов в пределах SEQ_STEP_BUDGET
+static const seq_insn_t prog_stall[] = {
+    INSN(SEQ_OP_LOOP, 0, 0, 100000, 0),
+    INSN(SEQ_OP_NEXT, 0, 0, 0, 0),
+    INSN(SEQ_OP_HIGH, 0, 0, 10, 0),
+};
+
+#define PROG(p) (p), (uint16_t)(sizeof(p) / sizeof((p)[0]))
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Сумма длительностей блока; zero — число нулевых половин символов
+static uint64_t sum_durations(const uint32_t *w, uint32_t n, uint32_t *zero)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t d0 = w[i] & 0x7FFF;
+        uint32_t d1 = (w[i] >> 16) & 0x7FFF;
+        if (d0 == 0) (*zero)++;
+        if (d1 == 0) (*zero)++;
+        sum += d0 + d1;
+    }
+    return sum;
+}
+
+static void check_programs(void)
+{
+    static uint32_t buf[CHUNK_SYMBOLS];
+    seq_vm_t vm;
+    const char *err = NULL;
+
+    expect(seq_program_validate(PROG(prog_60_2), &err), "60-2 validates");
+    expect(seq_program_validate(PROG(prog_fault), &err), "fault validates");
+    expect(seq_program_validate(PROG(prog_halt), &err), "halt validates");
+
+    // Программа с HALT: полный вывод без разрывов, затем окончание
+    seq_vm_reset(&vm, PROG(prog_halt));
+    uint64_t total = 0;
+    uint32_t zero = 0;
+    uint32_t n;
+    while ((n = seq_vm_fill(&vm, buf, CHUNK_SYMBOLS)) > 0) {
+        total += sum_durations(buf, n, &zero);
+    }
+    expect(vm.end == SEQ_END_HALT, "halt reported");
+    expect(total == 1000ULL * 60000ULL, "halt program duration");
+    expect(zero <= 1, "no zero durations before the closing half");
+    expect(seq_vm_fill(&vm, buf, CHUNK_SYMBOLS) == 0, "no output after halt");
+
+    // Пустой цикл: окончание по бюджету шагов
+    seq_vm_reset(&vm, PROG(prog_stall));
+    n = seq_vm_fill(&vm, buf, CHUNK_SYMBOLS);
+    expect(n == 0 && vm.end == SEQ_END_STALL, "stall reported");
+
+    // Пропуск зуба: на обороте 0 зуб 7 выводится низким уровнем
+    seq_vm_reset(&vm, PROG(prog_fault));
+    n = seq_vm_fill(&vm, buf, CHUNK_SYMBOLS);
+    expect(n == CHUNK_SYMBOLS, "fault program fills a chunk");
+    expect((buf[7] >> 15 & 1) == 0 && (buf[7] & 0x7FFF) == 277, "tooth 7 dropped on rev 0");
+    // пропущенный зуб — одна половина символа, дальше пары сдвинуты: зуб 7 оборота 1
+    // начинается с половины 71 + 14 = 85, то есть со второй половины символа 42
+    expect((buf[42] >> 31) == 1 && ((buf[42] >> 16) & 0x7FFF) == 100, "tooth 7 present on rev 1");
+}
+
+static void bench(const char *name, const seq_insn_t *prog, uint16_t len)
+{
+    static uint32_t buf[CHUNK_SYMBOLS];
+    seq_vm_t vm;
+    seq_vm_reset(&vm, prog, len);
+
+    uint64_t symbols = 0;
+    int64_t t0 = now_ns();
+    int64_t elapsed = 0;
+    while (elapsed < BENCH_NS) {
+        for (int i = 0; i < 1000; ++i) {
+            symbols += seq_vm_fill(&vm, buf, CHUNK_SYMBOLS);
+        }
+        elapsed = now_ns() - t0;
+    }
+    printf("%-8s %8.2f Msym/s\n", name, (double)symbols * 1000.0 / (double)elapsed);
+}
+
+int main(void)
+{
+    check_programs();
+    if (s_failures) return 1;
+
+    bench("60-2", PROG(prog_60_2));
+    bench("fault", PROG(prog_fault));
+    bench("long", PROG(prog_long));
+    return 0;
+}
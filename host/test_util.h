@@ -0,0 +1,16 @@
+#pragma once
+
+// Общие проверки хостовых программ: expect() печатает неудачу и считает ее,
+// main() возвращает ненулевой код, если s_failures > 0.
+
+#include <stdio.h>
+
+static int s_failures = 0;
+
+static void expect(int cond, const char *what)
+{
+    if (!cond) {
+        printf("FAIL: %s\n", what);
+        s_failures++;
+    }
+}
@@ -0,0 +1,87 @@
+#include <string.h>
+
+#include "con_proto.h"
+
+// CRC-16/CCITT-FALSE (полином 0x1021, начальное значение 0xFFFF)
+uint16_t con_crc16(uint16_t crc, const uint8_t *data, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+uint32_t con_get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void con_put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+// Разбор входного потока по байту.
+// Возвращает 1 — принят кадр, -1 — ошибка CRC, 0 — кадр еще не собран.
+int con_parser_feed(con_parser_t *p, uint8_t b)
+{
+    switch (p->st) {
+    case CON_ST_SYNC0:
+        if (b == CON_SYNC0) p->st = CON_ST_SYNC1;
+        return 0;
+    case CON_ST_SYNC1:
+        p->st = (b == CON_SYNC1) ? CON_ST_CMD : (b == CON_SYNC0 ? CON_ST_SYNC1 : CON_ST_SYNC0);
+        return 0;
+    case CON_ST_CMD:
+        p->cmd = b;
+        p->st = CON_ST_LEN;
+        return 0;
+    case CON_ST_LEN:
+        if (b > CON_MAX_PAYLOAD) {
+            p->st = CON_ST_SYNC0; // длина вне протокола — это не кадр, ищем синхробайты дальше
+            return 0;
+        }
+        p->len = b;
+        p->pos = 0;
+        p->st = (b > 0) ? CON_ST_PAYLOAD : CON_ST_CRC0;
+        return 0;
+    case CON_ST_PAYLOAD:
+        p->payload[p->pos++] = b;
+        if (p->pos >= p->len) p->st = CON_ST_CRC0;
+        return 0;
+    case CON_ST_CRC0:
+        p->crc_rx = b;
+        p->st = CON_ST_CRC1;
+        return 0;
+    case CON_ST_CRC1: {
+        p->crc_rx |= (uint16_t)b << 8;
+        p->st = CON_ST_SYNC0;
+        uint8_t hdr[2] = { p->cmd, p->len };
+        uint16_t crc = con_crc16(0xFFFF, hdr, sizeof(hdr));
+        crc = con_crc16(crc, p->payload, p->len);
+        return (crc == p->crc_rx) ? 1 : -1;
+    }
+    }
+    p->st = CON_ST_SYNC0;
+    return 0;
+}
+
+// Сборка кадра в out (не меньше len + CON_FRAME_OVERHEAD байт). Возвращает размер кадра.
+size_t con_frame_build(uint8_t *out, uint8_t cmd, const uint8_t *payload, uint8_t len)
+{
+    out[0] = CON_SYNC0;
+    out[1] = CON_SYNC1;
+    out[2] = cmd;
+    out[3] = len;
+    if (len > 0) memcpy(&out[4], payload, len);
+    uint16_t crc = con_crc16(0xFFFF, &out[2], (size_t)len + 2);
+    out[4 + len] = (uint8_t)crc;
+    out[5 + len] = (uint8_t)(crc >> 8);
+    return (size_t)len + CON_FRAME_OVERHEAD;
+}
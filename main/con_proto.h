@@ -0,0 +1,54 @@
+#pragma once
+
+// Бинарная консоль: кадрирование и CRC. Не зависит от ESP-IDF и транспорта,
+// поэтому собирается и проверяется на хосте через pty (host/con_pty_test.c).
+//
+// Кадр: 0xA5 0x5A | cmd | len | payload[len] | crc16 (LE), CRC-16/CCITT-FALSE по cmd, len и payload.
+// Ответ несет cmd | CON_RSP_FLAG, ошибка — CON_RSP_NAK с кодом CON_ERR_*. Текст журнала
+// может идти по тому же каналу: хост находит кадры по синхробайтам и CRC.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CON_SYNC0 0xA5
+#define CON_SYNC1 0x5A
+#define CON_MAX_PAYLOAD 64
+#define CON_FRAME_OVERHEAD 6 // синхробайты, cmd, len, crc16
+#define CON_CMD_PING 0x00
+#define CON_CMD_SET 0x01 // настройки генератора, CON_SET_LEN байт; ответ — тикет u32
+#define CON_CMD_STATUS 0x02 // ответ — CON_STATUS_LEN байт
+#define CON_CMD_STREAM 0x03 // период потока статуса u16 в мс (0 — выключить)
+#define CON_RSP_FLAG 0x80
+#define CON_RSP_NAK 0x7F
+#define CON_ERR_CRC 1
+#define CON_ERR_CMD 2
+#define CON_ERR_LEN 3
+#define CON_ERR_PARAM 4
+#define CON_SET_LEN 18
+#define CON_SET_ENC_LEN 22 // SET с настройками энкодера
+#define CON_STATUS_LEN 40
+
+typedef enum {
+    CON_ST_SYNC0 = 0,
+    CON_ST_SYNC1,
+    CON_ST_CMD,
+    CON_ST_LEN,
+    CON_ST_PAYLOAD,
+    CON_ST_CRC0,
+    CON_ST_CRC1,
+} con_state_t;
+
+typedef struct {
+    con_state_t st;
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t pos;
+    uint16_t crc_rx;
+    uint8_t payload[CON_MAX_PAYLOAD];
+} con_parser_t;
+
+uint16_t con_crc16(uint16_t crc, const uint8_t *data, size_t n);
+uint32_t con_get_u32(const uint8_t *p);
+void con_put_u32(uint8_t *p, uint32_t v);
+int con_parser_feed(con_parser_t *p, uint8_t b);
+size_t con_frame_build(uint8_t *out, uint8_t cmd, const uint8_t *payload, uint8_t len);
@@ -3,7 +3,6 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <ctype.h>
-#include <math.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -14,6 +13,17 @@
 #include "esp_timer.h"
 #include "driver/rmt_tx.h"
 #include "driver/rmt_encoder.h"
+#include "driver/mcpwm_cap.h"
+#include "driver/usb_serial_jtag.h"
+#include "esp_idf_version.h"
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+#include "driver/usb_serial_jtag_vfs.h"
+#else
+#include "esp_vfs_usb_serial_jtag.h"
+#endif
+#include "hal/gpio_ll.h"
+#include "esp_rom_gpio.h"
+#include "soc/gpio_sig_map.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "esp_netif.h"
@@ -21,15 +31,22 @@
 #include "esp_wifi.h"
 #include "esp_http_server.h"
 
+#include "con_proto.h"
+#include "seq_vm.h"
+
 #define SLOW_PWM 5
 #define FAST_PWM 6
+#define TRIG_IN 4 // вход внешнего запуска/останова медленного ШИМ
+#define CAP_IN 7 // вход сигнала датчика для режима слежения
+#define ENC_B 15 // канал B эмулятора энкодера (канал A — SLOW_PWM)
+#define ENC_Z 16 // индексный канал Z эмулятора энкодера
 
 static const char *TAG = "web_input";
 
 static volatile uint32_t g_pulse_us = 100000; // длительность импульса по умолчанию (мкс)
 static volatile uint32_t g_pause_us = 900000; // длительность паузы по умолчанию (мкс)
 static volatile int g_pulses_per_rev = 1; // импульсов на оборот по умолчанию
-static volatile double g_rpm = 60.0; // обороты в минуту по умолчанию
+static volatile uint32_t g_rpm_milli = 60000; // обороты в минуту ×1000 (фиксированная точка), по умолчанию 60.000
 static volatile int g_pulse_percent = 10; // процент ширины импульса (1..99)
 static volatile bool g_output_enabled = false;
 static volatile bool g_use_rmt = false;
@@ -38,15 +55,6 @@ static rmt_channel_handle_t g_rmt_channel = NULL;
 static rmt_encoder_handle_t g_rmt_copy_encoder = NULL;
 static SemaphoreHandle_t g_param_lock = NULL;
 
-typedef struct {
-    int pulses_per_rev;
-    uint32_t pulse_us;
-    uint32_t pause_us;
-    int pulse_pct;
-    double rpm;
-    bool enabled;
-} rmt_params_t;
-
 typedef struct {
     rmt_symbol_word_t *items;
     uint32_t cap;
@@ -54,11 +62,10 @@ typedef struct {
     bool half_filled;
 } rmt_symbol_builder_t;
 
-static rmt_params_t g_params;
 // (удален неиспользуемый g_cfg_sem)
 
 // Глобальные переменные для быстрого ШИМ (LEDC)
-static volatile double g_fast_freq_hz = 1000.0; // Гц
+static volatile uint32_t g_fast_freq_hz = 1000; // Гц
 static volatile int g_fast_pulse_pct = 10; // 1..99
 static volatile bool g_fast_enabled = false;
 static const ledc_timer_t g_ledc_timer = LEDC_TIMER_0;
@@ -70,16 +77,287 @@ static void update_fast_pwm_from_globals(void);
 
 // Настройки RMT
 #define RMT_CLK_DIV 80 // тик 1 мкс (80 МГц / 80 = 1 МГц)
+#define RMT_DEFAULT_RESOLUTION_HZ 1000000 // разрешение секвенсора и режима слежения (длительности в мкс)
+// Допустимая ошибка квантования периода зуба при выборе разрешения кадра
+#define RMT_TARGET_PPM 50
+// С такого периода зуба равномерный кадр содержит один зуб вместо целого оборота
+#define RMT_TOOTH_FRAME_MIN_US 100000
 // Максимальная длительность сегмента RMT (в тиках) - 15 бит: 32767
 #define RMT_MAX_DURATION 32767
 // Ограничение безопасности для динамически выделяемых элементов
 #define RMT_MAX_ITEMS_CAP 2048
-// Сколько транзакций ставить в очередь для непрерывной передачи
-#define RMT_TX_QUEUE_DEPTH 4
-// Сколько кадров оборота держать в очереди (рекомендуется 1-2)
-#define RMT_TX_KEEP_QUEUED 2
+// Глубина очереди транзакций канала; фактически держится столько, сколько
+// покрывает задержку пополнения (от RMT_TX_MIN_QUEUED до RMT_TX_QUEUE_DEPTH)
+#define RMT_TX_QUEUE_DEPTH 16
+#define RMT_TX_MIN_QUEUED 2
+// Запас к пиковой задержке пополнения при расчете числа транзакций в очереди
+#define RMT_REFILL_MARGIN_US 2000
+// Кадр короче минимальной длины повторяется несколько оборотов подряд в одной транзакции.
+// Минимальная длина растет с наблюдаемой задержкой пополнения (от RMT_FRAME_MIN_US
+// до RMT_FRAME_MAX_MIN_US), чтобы ее покрытие укладывалось в половину очереди канала.
+#define RMT_FRAME_MIN_US 2000
+#define RMT_FRAME_MAX_MIN_US 20000
+// Через сколько без опустошения очереди снимается одна добавочная транзакция
+#define RMT_UNDERRUN_DECAY_MS 60000
 // Задержка после перенастройки частоты, чтобы избежать артефактов на выходе
 #define RMT_REBUILD_DELAY_MS 5000
+// Биты уведомления задачи RMT: старший бит — изменение конфигурации,
+// младшие биты — счетчик завершенных транзакций (vTaskNotifyGiveFromISR)
+#define RMT_NOTIFY_RECONFIG 0x80000000
+#define RMT_NOTIFY_TRIG_START 0x40000000 // передний фронт входа запуска
+#define RMT_NOTIFY_TRIG_STOP 0x20000000 // задний фронт входа запуска (режим GATE)
+#define RMT_NOTIFY_CAPTURE 0x10000000 // новый фронт на входе CAP_IN (режим слежения)
+#define RMT_NOTIFY_DONE_MASK 0x07FFFFFF
+
+// Результат работы задачи RMT с одной конфигурацией
+typedef enum {
+    RMT_RUN_FAILED = 0, // канал не запущен, повторить попытку
+    RMT_RUN_RECONFIG,   // запрошена перенастройка
+    RMT_RUN_STOPPED,    // остановлен внешним запуском, параметры прежние
+} rmt_run_result_t;
+
+typedef enum {
+    RMT_EVT_DONE = 0,
+    RMT_EVT_RECONFIG,
+    RMT_EVT_STOP,
+    RMT_EVT_RESYNC,
+} rmt_event_t;
+
+// Внешний запуск (вход TRIG_IN)
+typedef enum {
+    TRIG_MODE_OFF = 0, // вход не используется
+    TRIG_MODE_GATE,    // передний фронт — запуск кадра с начала, задний — останов
+    TRIG_MODE_RESYNC,  // генерация идет непрерывно, передний фронт перезапускает кадр с первого зуба
+} trig_mode_t;
+
+static volatile int g_trig_mode = TRIG_MODE_OFF;
+// Измерение задержки фронт запуска -> первый фронт на SLOW_PWM
+static volatile int64_t g_trig_edge_us = 0;
+static volatile bool g_trig_measure = false;
+static int g_trig_isr_core = 0; // ядро, на котором установлен сервис прерываний GPIO
+// Выход подключен к RMT и передача разрешена: только в этом состоянии задний фронт
+// в режиме GATE отключает выход в ISR (во время ожидания запуска отключать нечего)
+static volatile bool g_trig_armed = false;
+static volatile uint32_t g_trig_lat_last_us = 0;
+static volatile uint32_t g_trig_lat_min_us = 0;
+static volatile uint32_t g_trig_lat_max_us = 0;
+static volatile uint32_t g_trig_count = 0;
+
+// Режим слежения: выход повторяет входной сигнал CAP_IN с рациональным множителем mul/div
+#define FOLLOW_TOOTH_SYMBOLS 160 // символов на один выходной зуб (с учетом дробления длинных сегментов)
+#define FOLLOW_BUFFERS 2 // зубьев в очереди: пока передается один, следующий уже поставлен
+#define FOLLOW_MIN_PERIOD_US 20
+#define FOLLOW_MAX_PERIOD_US 5000000
+#define FOLLOW_LOSS_PERIODS 3 // сигнал потерян, если нет фронта дольше 3 периодов
+#define FOLLOW_LOSS_MIN_US 100000
+#define FOLLOW_MAX_IN_PERIOD_US 10000000 // самый длинный измеряемый период входа
+#define FOLLOW_IDLE_POLL_MS 20
+#define FOLLOW_MAX_TEETH 120
+#define FOLLOW_MAX_RATIO 100
+
+typedef struct {
+    int in_teeth; // зубьев на оборот у входного сигнала
+    int mul;      // множитель частоты оборотов
+    int div;      // делитель частоты оборотов
+} follow_cfg_t;
+
+static volatile bool g_follow_enabled = false;
+static follow_cfg_t g_follow = { .in_teeth = 1, .mul = 1, .div = 1 };
+
+// Эмуляция инкрементального энкодера A/B/Z от уставки оборотов. Каждый канал передает
+// один свой период из памяти канала в аппаратном цикле (loop_count = -1), старт трех
+// каналов выравнивается менеджером синхронизации; общий тик держит фазы без дрейфа.
+#define ENC_SRC_CLK_HZ 80000000 // источник тактирования RMT, разрешение = 80 МГц / делитель
+#define ENC_DIV_MAX 256
+#define ENC_MEM_SYMBOLS SOC_RMT_MEM_WORDS_PER_CHANNEL
+// Z создается первым и занимает два блока памяти: четыре блока TX на A, B и Z без остатка
+#define ENC_Z_MEM_SYMBOLS (2 * SOC_RMT_MEM_WORDS_PER_CHANNEL)
+#define ENC_MAX_LINES 10000
+#define ENC_DEFAULT_LINES 1024
+
+typedef struct {
+    int lines; // штрихов (периодов A) на оборот
+    int dir;   // 0 — A опережает B, 1 — B опережает A
+} enc_cfg_t;
+
+typedef struct {
+    uint32_t res_hz;
+    uint32_t quarter; // четверть штриха в тиках
+    uint32_t err_ppb; // ошибка периода штриха относительно точного значения
+} enc_plan_t;
+
+static volatile bool g_enc_enabled = false;
+static enc_cfg_t g_enc = { .lines = ENC_DEFAULT_LINES, .dir = 0 };
+static volatile uint32_t g_enc_res_hz = 0;
+static volatile uint32_t g_enc_err_ppb = 0;
+// Результаты захвата (пишутся из ISR)
+static volatile uint32_t g_cap_resolution_hz = 0;
+static volatile uint32_t g_cap_last_value = 0;
+static volatile uint32_t g_cap_period_ticks = 0;
+static volatile uint32_t g_cap_last_edge_us = 0;
+static volatile uint8_t g_cap_valid_edges = 0;
+
+// Настройки секвенсора (формат программы и интерпретатор — seq_vm.h)
+#define SEQ_CHUNK_SYMBOLS 256 // символов RMT в одной транзакции секвенсора
+#define SEQ_RING_MAX 4 // макс. буферов в кольце секвенсора
+
+// Загруженная программа (под g_param_lock); пустая программа — обычный режим
+static seq_insn_t g_seq_prog[SEQ_MAX_INSNS];
+static volatile uint16_t g_seq_len = 0;
+// Статистика производительности интерпретатора
+static volatile uint32_t g_seq_symbols_per_sec = 0;
+// Окончание программы (seq_end_t): вывод остановлен, линия в низком уровне до RESYNC или перенастройки
+static volatile uint8_t g_seq_end = SEQ_END_NONE;
+
+// Примененные параметры (под g_param_lock): копируются из глобальных переменных только при
+// применении (update_pwm_from_globals), поэтому промежуточные состояния пачки запросов
+// сюда не попадают. Задача RMT берет из них снимок; режим запуска и флаги режимов
+// ISR читают отсюда же без блокировки.
+typedef struct {
+    int pulses_per_rev;
+    uint32_t pulse_us;
+    uint32_t pause_us;
+    int pulse_pct;
+    uint32_t rpm_milli;
+    bool enabled;
+    volatile int trig_mode;
+    volatile bool follow;
+    follow_cfg_t follow_cfg;
+    volatile bool enc;
+    enc_cfg_t enc_cfg;
+    uint16_t seq_len;
+    seq_insn_t seq_prog[SEQ_MAX_INSNS];
+    uint32_t version; // версия запроса, вошедшая в снимок
+} rmt_params_t;
+
+static rmt_params_t g_params;
+
+// Планировщик перенастройки: запросы внутри окна объединяются в одно применение,
+// промежуточные состояния не применяются. Каждому запросу выдается версия (тикет),
+// генератор публикует версию, которую подхватил.
+#define RECONFIG_COALESCE_MS 50 // тишина после последнего запроса перед применением
+#define RECONFIG_MAX_DELAY_MS 250 // предельная задержка первого запроса пачки
+#define RECONFIG_MIN_INTERVAL_MS 200 // мин. интервал между применениями
+static esp_timer_handle_t g_reconfig_timer = NULL;
+static TaskHandle_t g_reconfig_task = NULL; // единственный исполнитель применения (снимок, LEDC)
+static portMUX_TYPE g_reconfig_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint32_t g_cfg_requested = 0; // последний выданный тикет
+static volatile uint32_t g_cfg_applied = 0; // версия, подхваченная задачей RMT
+static volatile bool g_rmt_settling = false; // снимок взят, выход ждет окончания паузы перестройки
+static int64_t g_reconfig_first_us = 0; // первый запрос текущей пачки (0 — пачки нет)
+static int64_t g_reconfig_last_apply_us = 0;
+static volatile uint32_t g_reconfig_applies = 0;
+static volatile uint32_t g_reconfig_merged = 0; // запросы, объединенные с предыдущими
+
+// Бинарная консоль USB-Serial-JTAG (работает без Wi-Fi), протокол — в con_proto.h.
+// Текст журнала ESP_LOG идет по тому же каналу.
+#define CON_STREAM_MIN_MS 10
+#define CON_POLL_MS 20
+
+// Кэш собранных кадров (LRU) и именованные пресеты
+#define FRAME_CACHE_SLOTS 8
+#define FRAME_DRAIN_MAX 3 // прежние кадры, одновременно ожидающие ухода из очереди RMT
+#define FRAME_CACHE_MAX_SYMBOLS 8192 // общий бюджет символов во всех кадрах кэша
+#define FRAME_PATTERN_UNIFORM 0 // кадр из одинаковых зубьев
+#define PRESET_MAX 8
+#define PRESET_NAME_LEN 16
+#define PRESET_PIN_MAX (FRAME_CACHE_SLOTS - 2) // оставляем слоты для незакрепленных кадров
+
+typedef struct {
+    int pulses;
+    uint32_t rpm_milli;
+    int pulse_pct;
+    uint32_t pattern;
+} frame_key_t;
+
+// Разрешение канала и форма равномерного кадра
+typedef struct {
+    uint32_t res_hz;
+    uint32_t pulse_ticks;
+    uint32_t pause_ticks;
+    uint32_t teeth;   // зубьев в одном кадре (1 или pulses × reps)
+    uint32_t reps;    // оборотов в кадре (короткий оборот повторяется)
+    uint32_t frame_us; // длительность кадра
+    uint32_t symbols; // символов RMT в кадре
+    uint32_t err_ppb; // ошибка периода зуба относительно точного значения
+} rmt_frame_plan_t;
+
+// Допустимые разрешения канала: делители источника 80 МГц (8, 16, 40, 80, 160, 200, 250),
+// от мелкого тика к крупному
+static const uint32_t k_rmt_resolutions_hz[] = { 10000000, 5000000, 2000000, 1000000, 500000, 400000, 320000 };
+
+typedef struct {
+    frame_key_t key;
+    rmt_symbol_word_t *items; // NULL — слот свободен
+    uint32_t count;
+    rmt_frame_plan_t plan;
+    uint32_t last_use;
+    uint32_t readers; // открытые чтения /frame (под g_frame_mux)
+    bool truncated;
+    bool pinned;
+    bool stale; // заменен более длинным кадром: не находится поиском, вытесняется первым
+} frame_cache_entry_t;
+
+typedef struct {
+    char name[PRESET_NAME_LEN];
+    int pulses;
+    uint32_t rpm_milli;
+    int pulse_pct;
+    bool used;
+    bool pinned;
+} preset_t;
+
+static frame_cache_entry_t g_frame_cache[FRAME_CACHE_SLOTS];
+static SemaphoreHandle_t g_frame_cache_lock = NULL; // слоты кэша, закрепление и счетчики
+static frame_cache_entry_t *g_frame_cache_active = NULL; // кадр, передаваемый сейчас
+// Прежние кадры, еще стоящие в очереди RMT, в порядке замены (FIFO)
+static frame_cache_entry_t *g_frame_cache_draining[FRAME_DRAIN_MAX];
+static uint32_t g_frame_cache_drain_n = 0;
+static uint32_t g_frame_cache_clock = 0;
+static volatile uint32_t g_frame_cache_hits = 0;
+static volatile uint32_t g_frame_cache_misses = 0;
+static volatile uint32_t g_frame_cache_evictions = 0;
+// Опубликованный для /frame кадр и его версия (меняется при каждой публикации/снятии)
+static portMUX_TYPE g_frame_mux = portMUX_INITIALIZER_UNLOCKED;
+static frame_cache_entry_t *g_frame_published = NULL;
+static volatile uint32_t g_frame_version = 0;
+// Таблица пресетов (под g_param_lock)
+static preset_t g_presets[PRESET_MAX];
+// Разрешение, с которым создается канал RMT, и параметры передаваемого кадра (для /status)
+static uint32_t g_rmt_resolution_hz = RMT_DEFAULT_RESOLUTION_HZ;
+static uint32_t g_rmt_channel_res_hz = 0;
+static bool g_rmt_channel_loopback = false; // канал создан с io_loop_back (вход запуска включен)
+
+// Снимок параметров, с которым работает задача RMT
+typedef struct {
+    bool enabled;
+    frame_key_t key;
+    int trig_mode;
+    bool follow;
+    follow_cfg_t follow_cfg;
+    bool enc;
+    enc_cfg_t enc_cfg;
+    uint16_t seq_len;
+} rmt_snapshot_t;
+static volatile uint32_t g_frame_res_hz = RMT_DEFAULT_RESOLUTION_HZ;
+static volatile uint32_t g_frame_symbols = 0;
+static volatile uint32_t g_frame_err_ppb = 0;
+static volatile bool g_frame_truncated = false;
+static volatile uint32_t g_frame_reps = 1;
+// Учет транзакций RMT в полете: инкремент при постановке, декремент в callback.
+// Опустошение очереди во время непрерывной передачи (g_rmt_streaming) — разрыв на выходе.
+static portMUX_TYPE g_rmt_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint32_t g_rmt_inflight = 0;
+static volatile bool g_rmt_streaming = false;
+static volatile uint32_t g_rmt_done_us = 0; // время последнего завершения (младшие 32 бита esp_timer)
+static volatile uint32_t g_rmt_done_total = 0; // завершенных транзакций с запуска (под g_rmt_mux)
+static volatile uint32_t g_rmt_underruns = 0;
+static volatile uint32_t g_rmt_refill_lat_us = 0; // последняя задержка пополнения
+static volatile uint32_t g_rmt_refill_peak_us = 0; // пиковая задержка с медленным спадом
+static volatile uint32_t g_rmt_underrun_slack = 0; // добавочные транзакции после опустошений
+static volatile uint32_t g_rmt_queue_target = RMT_TX_MIN_QUEUED;
+static volatile uint32_t g_rmt_frame_min_us = RMT_FRAME_MIN_US; // текущая минимальная длина кадра
+static volatile uint32_t g_rmt_queue_adjusts = 0;
 
 // Использование RMT для генерации импульсов (покрывает весь частотный диапазон)
 
@@ -91,9 +369,16 @@ static void rmt_tx_task(void *arg);
 static void network_task(void *arg);
 static httpd_handle_t start_webserver(void);
 static void wifi_init_softap(void);
-static bool compute_pulse_timing(int pulses_per_rev, double rpm, int pulse_pct, uint32_t *out_pulse_us, uint32_t *out_pause_us, uint32_t *out_total_us, double *out_freq_hz);
+static bool compute_pulse_ticks(int pulses_per_rev, uint32_t rpm_milli, int pulse_pct, uint32_t res_hz, uint32_t *out_pulse, uint32_t *out_pause, uint32_t *out_total);
+static bool compute_pulse_timing(int pulses_per_rev, uint32_t rpm_milli, int pulse_pct, uint32_t *out_pulse_us, uint32_t *out_pause_us, uint32_t *out_total_us, uint32_t *out_freq_mhz);
+static bool rmt_plan_frame(const frame_key_t *key, rmt_frame_plan_t *plan);
+static bool enc_plan(const enc_cfg_t *cfg, uint32_t rpm_milli, enc_plan_t *plan);
+static bool parse_fixed_milli(const char *s, uint32_t *out_milli);
 static bool rmt_builder_append_segment(rmt_symbol_builder_t *b, uint32_t level, uint32_t duration);
 static uint32_t rmt_builder_finalize(rmt_symbol_builder_t *b);
+static void trig_init(void);
+static void cap_init(void);
+static uint32_t cap_input_freq_mhz(void);
 
 // Настройки SoftAP
 #define AP_SSID "SSID"
@@ -102,31 +387,143 @@ static uint32_t rmt_builder_finalize(rmt_symbol_builder_t *b);
 
 // Использование аппаратного ШИМ LEDC для стабильной частоты и скважности
 
-static bool compute_pulse_timing(int pulses_per_rev, double rpm, int pulse_pct, uint32_t *out_pulse_us, uint32_t *out_pause_us, uint32_t *out_total_us, double *out_freq_hz)
+// Обороты хранятся в фиксированной точке (RPM ×1000), все длительности считаются целочисленно.
+// Период в тиках = 60 * res / (rpm * pulses) = 60000 * res / (rpm_milli * pulses), округление к ближайшему.
+#define RPM_MILLI_SCALE 1000U
+#define RPM_MILLI_MAX (1000U * RPM_MILLI_SCALE)
+
+static bool compute_pulse_ticks(int pulses_per_rev, uint32_t rpm_milli, int pulse_pct, uint32_t res_hz, uint32_t *out_pulse, uint32_t *out_pause, uint32_t *out_total)
 {
     if (pulses_per_rev < 1) pulses_per_rev = 1;
     if (pulses_per_rev > 10) pulses_per_rev = 10;
     if (pulse_pct < 1) pulse_pct = 1;
     if (pulse_pct > 99) pulse_pct = 99;
-    if (rpm <= 0.0) return false;
-    if (rpm > 1000.0) rpm = 1000.0;
+    if (rpm_milli == 0) return false;
+    if (rpm_milli > RPM_MILLI_MAX) rpm_milli = RPM_MILLI_MAX;
 
-    double freq_hz = (rpm / 60.0) * (double)pulses_per_rev;
-    if (freq_hz <= 0.0) return false;
+    // Знаменатель не превышает 1e6 * 10, поэтому помещается в 32 бита
+    uint32_t den = rpm_milli * (uint32_t)pulses_per_rev;
+    uint64_t num = 60000ULL * res_hz;
 
-    double period_us = 1000000.0 / freq_hz;
-    uint32_t total_us = (uint32_t)llround(period_us);
-    if (total_us < 2) total_us = 2;
+    uint64_t total = (num + den / 2) / den;
+    if (total > UINT32_MAX) return false;
+    if (total < 2) total = 2;
 
-    uint32_t pulse_us = (uint32_t)llround(period_us * ((double)pulse_pct / 100.0));
-    if (pulse_us < 1) pulse_us = 1;
-    if (pulse_us >= total_us) pulse_us = total_us - 1;
-    uint32_t pause_us = total_us - pulse_us;
+    // Импульс считается от точного рационального периода, а не от округленного total
+    uint32_t pulse = (uint32_t)((num / 100U * (uint64_t)pulse_pct + den / 2) / den);
+    if (pulse < 1) pulse = 1;
+    if (pulse >= total) pulse = (uint32_t)total - 1;
+
+    if (out_pulse) *out_pulse = pulse;
+    if (out_pause) *out_pause = (uint32_t)total - pulse;
+    if (out_total) *out_total = (uint32_t)total;
+    return true;
+}
+
+static bool compute_pulse_timing(int pulses_per_rev, uint32_t rpm_milli, int pulse_pct, uint32_t *out_pulse_us, uint32_t *out_pause_us, uint32_t *out_total_us, uint32_t *out_freq_mhz)
+{
+    if (!compute_pulse_ticks(pulses_per_rev, rpm_milli, pulse_pct, RMT_DEFAULT_RESOLUTION_HZ, out_pulse_us, out_pause_us, out_total_us)) {
+        return false;
+    }
+    // Частота в мГц: rpm_milli * pulses / 60
+    if (out_freq_mhz) *out_freq_mhz = (rpm_milli * (uint32_t)pulses_per_rev + 30U) / 60U;
+    return true;
+}
+
+// Выбор разрешения канала и формы кадра для равномерного кадра. Берется самый крупный тик,
+// при котором ошибка квантования периода зуба (полтика) не превышает RMT_TARGET_PPM,
+// иначе самый мелкий. Длинные одинаковые зубья передаются кадром из одного зуба,
+// который повторяется очередью, — число символов не растет с числом зубьев.
+static bool rmt_plan_frame(const frame_key_t *key, rmt_frame_plan_t *plan)
+{
+    const int n_res = (int)(sizeof(k_rmt_resolutions_hz) / sizeof(k_rmt_resolutions_hz[0]));
+    bool found = false;
+
+    for (int i = n_res - 1; i >= 0 && !found; --i) {
+        uint32_t res = k_rmt_resolutions_hz[i];
+        uint32_t pulse = 0;
+        uint32_t pause = 0;
+        uint32_t total = 0;
+        if (!compute_pulse_ticks(key->pulses, key->rpm_milli, key->pulse_pct, res, &pulse, &pause, &total)) {
+            continue;
+        }
+        // полтика в ppm от периода зуба: 0.5e6 / total
+        found = (i == 0) || ((500000U + total - 1) / total <= RMT_TARGET_PPM);
+        if (found) {
+            plan->res_hz = res;
+            plan->pulse_ticks = pulse;
+            plan->pause_ticks = pause;
+
+            // фактическая ошибка периода относительно точного значения, в ppb
+            uint64_t num = 60000ULL * res;
+            uint64_t den = (uint64_t)key->rpm_milli * (uint64_t)key->pulses;
+            uint64_t actual = (uint64_t)total * den;
+            uint64_t diff = (actual > num) ? actual - num : num - actual;
+            plan->err_ppb = (uint32_t)((diff * 1000000000ULL) / num);
+        }
+    }
+    if (!found) return false;
+
+    uint64_t tooth_us = ((uint64_t)(plan->pulse_ticks + plan->pause_ticks) * 1000000ULL) / plan->res_hz;
+    plan->teeth = (tooth_us >= RMT_TOOTH_FRAME_MIN_US) ? 1 : (uint32_t)key->pulses;
+
+    uint32_t chunks_per_pulse = (plan->pulse_ticks + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION;
+    uint32_t chunks_per_pause = (plan->pause_ticks + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION;
+
+    // Короткий оборот повторяется в кадре, чтобы одна транзакция длилась не меньше
+    // g_rmt_frame_min_us: реже прерывания и меньше транзакций нужно держать в очереди
+    uint64_t frame_us = tooth_us * plan->teeth;
+    uint32_t frame_min_us = g_rmt_frame_min_us;
+    uint32_t reps = 1;
+    if (frame_us > 0 && frame_us < frame_min_us) {
+        reps = (uint32_t)((frame_min_us + frame_us - 1) / frame_us);
+        uint32_t chunks_per_rev = plan->teeth * (chunks_per_pulse + chunks_per_pause);
+        uint32_t max_reps = (2U * RMT_MAX_ITEMS_CAP) / chunks_per_rev;
+        if (reps > max_reps) reps = max_reps;
+        if (reps == 0) reps = 1;
+    }
+    plan->reps = reps;
+    plan->teeth *= reps;
+    plan->frame_us = (uint32_t)(frame_us * reps);
+    plan->symbols = (plan->teeth * (chunks_per_pulse + chunks_per_pause) + 1) / 2;
+    return true;
+}
+
+// Разбор десятичного числа "123.4567" в фиксированную точку ×1000 (с округлением по 4-му знаку).
+// Возвращает false для пустых, отрицательных и нечисловых значений.
+static bool parse_fixed_milli(const char *s, uint32_t *out_milli)
+{
+    if (!s || !out_milli) return false;
+    while (*s == ' ') s++;
+    if (!isdigit((unsigned char)*s) && !(*s == '.' && isdigit((unsigned char)s[1]))) return false;
+
+    uint64_t whole = 0;
+    while (isdigit((unsigned char)*s)) {
+        whole = whole * 10U + (uint64_t)(*s - '0');
+        if (whole > UINT32_MAX / RPM_MILLI_SCALE) return false;
+        s++;
+    }
+
+    uint32_t frac = 0;
+    uint32_t scale = RPM_MILLI_SCALE;
+    bool round_up = false;
+    if (*s == '.') {
+        s++;
+        while (isdigit((unsigned char)*s)) {
+            if (scale > 1) {
+                scale /= 10U;
+                frac += (uint32_t)(*s - '0') * scale;
+            } else if (scale == 1) {
+                round_up = (*s >= '5');
+                scale = 0;
+            }
+            s++;
+        }
+    }
 
-    if (out_pulse_us) *out_pulse_us = pulse_us;
-    if (out_pause_us) *out_pause_us = pause_us;
-    if (out_total_us) *out_total_us = total_us;
-    if (out_freq_hz) *out_freq_hz = freq_hz;
+    uint64_t milli = whole * RPM_MILLI_SCALE + frac + (round_up ? 1U : 0U);
+    if (milli > UINT32_MAX) return false;
+    *out_milli = (uint32_t)milli;
     return true;
 }
 
@@ -166,6 +563,309 @@ static uint32_t rmt_builder_finalize(rmt_symbol_builder_t *b)
     return b->idx;
 }
 
+// ---------------------------------------------------------------------------
+// Кэш собранных кадров. Слоты, закрепление и счетчики защищены g_frame_cache_lock;
+// сама сборка кадра идет без блокировки, поэтому задача RMT не ждет чужую сборку.
+// Кадры закрепленных пресетов собираются заранее в обработчике /preset и не вытесняются,
+// так что переключение на пресет обходится без сборки. Передаваемый кадр и кадр,
+// еще стоящий в очереди после горячей замены, не вытесняются.
+// ---------------------------------------------------------------------------
+
+static bool frame_key_equal(const frame_key_t *a, const frame_key_t *b)
+{
+    return a->pulses == b->pulses && a->rpm_milli == b->rpm_milli &&
+           a->pulse_pct == b->pulse_pct && a->pattern == b->pattern;
+}
+
+static frame_cache_entry_t *frame_cache_find(const frame_key_t *key)
+{
+    for (int i = 0; i < FRAME_CACHE_SLOTS; ++i) {
+        if (g_frame_cache[i].items && !g_frame_cache[i].stale && frame_key_equal(&g_frame_cache[i].key, key)) {
+            return &g_frame_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void frame_cache_drop(frame_cache_entry_t *e)
+{
+    free(e->items);
+    memset(e, 0, sizeof(*e));
+}
+
+// Кадр передается или еще стоит в очереди (вызывается под g_frame_cache_lock)
+static bool frame_cache_in_flight(const frame_cache_entry_t *e)
+{
+    if (e == g_frame_cache_active) return true;
+    for (uint32_t i = 0; i < g_frame_cache_drain_n; ++i) {
+        if (g_frame_cache_draining[i] == e) return true;
+    }
+    return false;
+}
+
+// Снятие защиты: устаревший кадр освобождается сразу, если он больше нигде не стоит
+// в очереди и его не читает /frame (вызывается под g_frame_cache_lock)
+static void frame_cache_unprotect(frame_cache_entry_t *e)
+{
+    if (!e || !e->stale || frame_cache_in_flight(e)) return;
+    portENTER_CRITICAL(&g_frame_mux);
+    bool reading = (e->readers > 0);
+    portEXIT_CRITICAL(&g_frame_mux);
+    if (!reading) frame_cache_drop(e);
+}
+
+// Освобождение места: пустой слот и бюджет символов. Вытесняется устаревший или самый
+// давно использованный незакрепленный кадр, кроме передаваемых в данный момент.
+// Вызывается под g_frame_cache_lock.
+static frame_cache_entry_t *frame_cache_make_room(uint32_t need)
+{
+    while (1) {
+        uint32_t used_symbols = 0;
+        frame_cache_entry_t *free_slot = NULL;
+        frame_cache_entry_t *victim = NULL;
+        for (int i = 0; i < FRAME_CACHE_SLOTS; ++i) {
+            frame_cache_entry_t *e = &g_frame_cache[i];
+            if (!e->items) {
+                if (!free_slot) free_slot = e;
+                continue;
+            }
+            used_symbols += e->count;
+            if (e->pinned || frame_cache_in_flight(e)) continue;
+            // кадр, который сейчас отдается через /frame, не освобождаем
+            portENTER_CRITICAL(&g_frame_mux);
+            bool reading = (e->readers > 0);
+            portEXIT_CRITICAL(&g_frame_mux);
+            if (reading) continue;
+            if (!victim || (e->stale && !victim->stale) ||
+                (e->stale == victim->stale && e->last_use < victim->last_use)) victim = e;
+        }
+
+        if (free_slot && used_symbols + need <= FRAME_CACHE_MAX_SYMBOLS) return free_slot;
+        if (!victim) return NULL;
+        frame_cache_drop(victim);
+        g_frame_cache_evictions++;
+    }
+}
+
+// Сборка кадра по ключу в новый буфер (без блокировки кэша)
+static bool frame_cache_build(const frame_key_t *key, frame_cache_entry_t *out)
+{
+    rmt_frame_plan_t plan;
+    if (!rmt_plan_frame(key, &plan)) {
+        return false;
+    }
+
+    uint32_t total_items = plan.symbols;
+    if (total_items > RMT_MAX_ITEMS_CAP) {
+        ESP_LOGW(TAG, "RMT: requested %u items exceeds cap %u, clamping", total_items, RMT_MAX_ITEMS_CAP);
+        total_items = RMT_MAX_ITEMS_CAP;
+    }
+
+    size_t alloc_size = total_items * sizeof(rmt_symbol_word_t);
+    rmt_symbol_word_t *items = (rmt_symbol_word_t *)malloc(alloc_size);
+    if (!items) {
+        ESP_LOGE(TAG, "RMT: malloc failed for %u items", (unsigned)total_items);
+        return false;
+    }
+
+    // Построение потока символов кадра (высокий+низкий для каждого импульса).
+    // Важно: не вставлять duration1=0 внутрь потока, иначе RMT
+    // воспримет это как маркер остановки и преждевременно обрежет сигнал.
+    rmt_symbol_builder_t builder = {
+        .items = items,
+        .cap = total_items,
+        .idx = 0,
+        .half_filled = false,
+    };
+    bool truncated = false;
+    for (uint32_t p = 0; p < plan.teeth; ++p) {
+        if (!rmt_builder_append_segment(&builder, 1, plan.pulse_ticks) ||
+            !rmt_builder_append_segment(&builder, 0, plan.pause_ticks)) {
+            truncated = true;
+            break;
+        }
+    }
+    uint32_t idx = rmt_builder_finalize(&builder);
+    if (truncated) {
+        ESP_LOGW(TAG, "RMT: symbol buffer truncated (cap=%u)", (unsigned)total_items);
+    }
+    if (idx == 0) {
+        free(items);
+        return false;
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->key = *key;
+    out->items = items;
+    out->count = idx;
+    out->plan = plan;
+    out->truncated = truncated;
+    return true;
+}
+
+// Получение кадра по ключу: из кэша или со сборкой. count_stats=false для
+// предварительной сборки пресетов, чтобы она не искажала статистику попаданий.
+// Вызывается под g_frame_cache_lock; на время сборки блокировка отпускается, поэтому
+// результат нужно закрепить (active/pinned) до ее снятия.
+static frame_cache_entry_t *frame_cache_get_locked(const frame_key_t *key, bool count_stats)
+{
+    frame_cache_entry_t *e = frame_cache_find(key);
+    if (e) {
+        if (count_stats) g_frame_cache_hits++;
+        e->last_use = ++g_frame_cache_clock;
+        return e;
+    }
+    if (count_stats) g_frame_cache_misses++;
+
+    frame_cache_entry_t built;
+    xSemaphoreGive(g_frame_cache_lock);
+    bool ok = frame_cache_build(key, &built);
+    xSemaphoreTake(g_frame_cache_lock, portMAX_DELAY);
+    if (!ok) return NULL;
+
+    // тот же кадр мог быть собран другой задачей, пока блокировка была отпущена
+    e = frame_cache_find(key);
+    if (e) {
+        free(built.items);
+    } else {
+        e = frame_cache_make_room(built.count);
+        if (!e) {
+            ESP_LOGW(TAG, "RMT: frame cache full of pinned frames");
+            free(built.items);
+            return NULL;
+        }
+        *e = built;
+    }
+    e->last_use = ++g_frame_cache_clock;
+    return e;
+}
+
+// Кадр для передачи: получение из кэша и пометка передаваемым (не вытесняется)
+static frame_cache_entry_t *frame_cache_acquire(const frame_key_t *key)
+{
+    xSemaphoreTake(g_frame_cache_lock, portMAX_DELAY);
+    frame_cache_entry_t *e = frame_cache_get_locked(key, true);
+    g_frame_cache_active = e;
+    xSemaphoreGive(g_frame_cache_lock);
+    return e;
+}
+
+// Горячая замена передаваемого кадра: только при попадании в кэш, совпадении тика
+// с разрешением канала и свободном месте в FIFO прежних кадров. Прежний кадр остается
+// защищенным, пока его транзакции в очереди.
+static frame_cache_entry_t *frame_cache_swap(const frame_key_t *key, uint32_t res_hz)
+{
+    xSemaphoreTake(g_frame_cache_lock, portMAX_DELAY);
+    frame_cache_entry_t *e = frame_cache_find(key);
+    if (e && e->plan.res_hz == res_hz &&
+        (e == g_frame_cache_active || g_frame_cache_drain_n < FRAME_DRAIN_MAX)) {
+        g_frame_cache_hits++;
+        e->last_use = ++g_frame_cache_clock;
+        if (e != g_frame_cache_active) {
+            g_frame_cache_draining[g_frame_cache_drain_n++] = g_frame_cache_active;
+            g_frame_cache_active = e;
+        }
+    } else {
+        e = NULL;
+    }
+    xSemaphoreGive(g_frame_cache_lock);
+    return e;
+}
+
+// Пересборка передаваемого кадра под выросшую минимальную длину (больше оборотов в кадре).
+// Прежняя запись помечается устаревшей и передает новой закрепление; пока ее транзакции
+// в очереди, она защищена в g_frame_cache_draining. NULL — пересобрать не удалось.
+static frame_cache_entry_t *frame_cache_regrow(frame_cache_entry_t *old)
+{
+    xSemaphoreTake(g_frame_cache_lock, portMAX_DELAY);
+    if (g_frame_cache_drain_n >= FRAME_DRAIN_MAX) {
+        xSemaphoreGive(g_frame_cache_lock);
+        return NULL;
+    }
+    frame_key_t key = old->key;
+    bool pinned = old->pinned;
+    old->stale = true;
+    old->pinned = false;
+    frame_cache_entry_t *e = frame_cache_get_locked(&key, false);
+    if (e && e->plan.res_hz == old->plan.res_hz) {
+        e->pinned = pinned;
+        g_frame_cache_draining[g_frame_cache_drain_n++] = old;
+        g_frame_cache_active = e;
+    } else {
+        if (e) e->stale = true;
+        old->stale = false;
+        old->pinned = pinned;
+        e = NULL;
+    }
+    xSemaphoreGive(g_frame_cache_lock);
+    return e;
+}
+
+// Снятие защиты с n самых старых прежних кадров, чьи транзакции ушли из очереди
+static void frame_cache_release_drained(uint32_t n)
+{
+    xSemaphoreTake(g_frame_cache_lock, portMAX_DELAY);
+    if (n > g_frame_cache_drain_n) n = g_frame_cache_drain_n;
+    frame_cache_entry_t *done[FRAME_DRAIN_MAX];
+    memcpy(done, g_frame_cache_draining, n * sizeof(done[0]));
+    g_frame_cache_drain_n -= n;
+    memmove(&g_frame_cache_draining[0], &g_frame_cache_draining[n], g_frame_cache_drain_n * sizeof(done[0]));
+    for (uint32_t i = 0; i < n; ++i) frame_cache_unprotect(done[i]);
+    xSemaphoreGive(g_frame_cache_lock);
+}
+
+// Снятие защиты с кадров после остановки передачи (drained_only — только с прежних).
+// Устаревший кадр освобождается сразу, если его не читает /frame.
+static void frame_cache_release(bool drained_only)
+{
+    frame_cache_release_drained(FRAME_DRAIN_MAX);
+    if (drained_only) return;
+    xSemaphoreTake(g_frame_cache_lock, portMAX_DELAY);
+    frame_cache_entry_t *done = g_frame_cache_active;
+    g_frame_cache_active = NULL;
+    frame_cache_unprotect(done);
+    xSemaphoreGive(g_frame_cache_lock);
+}
+
+// Публикация передаваемого кадра для /frame (NULL — снять публикацию).
+// Новые чтения начинаются только с опубликованного кадра, поэтому после снятия
+// счетчик readers может только уменьшаться. Публикуется только защищенный кадр
+// (active или draining); защита снимается после перехода публикации на другой кадр.
+static void frame_publish(frame_cache_entry_t *e)
+{
+    portENTER_CRITICAL(&g_frame_mux);
+    g_frame_published = e;
+    g_frame_version++;
+    portEXIT_CRITICAL(&g_frame_mux);
+}
+
+// Пересчет закрепления по таблице пресетов и предварительная сборка их кадров.
+// Вызывается из обработчика /preset, вне цикла пополнения очереди RMT.
+static void frame_cache_sync_presets(void)
+{
+    frame_key_t keys[PRESET_MAX];
+    int n = 0;
+    if (!g_param_lock || xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(50)) != pdTRUE) return;
+    for (int i = 0; i < PRESET_MAX; ++i) {
+        if (g_presets[i].used && g_presets[i].pinned) {
+            keys[n].pulses = g_presets[i].pulses;
+            keys[n].rpm_milli = g_presets[i].rpm_milli;
+            keys[n].pulse_pct = g_presets[i].pulse_pct;
+            keys[n].pattern = FRAME_PATTERN_UNIFORM;
+            n++;
+        }
+    }
+    xSemaphoreGive(g_param_lock);
+
+    xSemaphoreTake(g_frame_cache_lock, portMAX_DELAY);
+    for (int i = 0; i < FRAME_CACHE_SLOTS; ++i) g_frame_cache[i].pinned = false;
+    for (int k = 0; k < n; ++k) {
+        frame_cache_entry_t *e = frame_cache_get_locked(&keys[k], false);
+        if (e) e->pinned = true;
+    }
+    xSemaphoreGive(g_frame_cache_lock);
+}
+
 static void init_pwm_from_globals(void)
 {
     // Создание канала передачи (TX) с использованием нового API RMT TX
@@ -173,19 +873,19 @@ static void init_pwm_from_globals(void)
         rmt_tx_channel_config_t tx_cfg = {
             .gpio_num = SLOW_PWM,
             .clk_src = RMT_CLK_SRC_DEFAULT,
-            .resolution_hz = 1000000, // 1 МГц -> тик 1 мкс
+            .resolution_hz = g_rmt_resolution_hz, // выбирается задачей RMT под конфигурацию
             .mem_block_symbols = SOC_RMT_MEM_WORDS_PER_CHANNEL,
             .trans_queue_depth = RMT_TX_QUEUE_DEPTH,
             .intr_priority = 1,
-            .flags = { .invert_out = 0, .with_dma = 1, .io_loop_back = 0, .io_od_mode = 0, .allow_pd = 0, .init_level = 0 }
+            .flags = { .invert_out = 0, .with_dma = 1, .io_loop_back = (g_params.trig_mode != TRIG_MODE_OFF), .io_od_mode = 0, .allow_pd = 0, .init_level = 0 }
         };
+        g_rmt_channel_loopback = tx_cfg.flags.io_loop_back;
 
         esp_err_t rc = rmt_new_tx_channel(&tx_cfg, &g_rmt_channel);
         if (rc != ESP_OK) {
             ESP_LOGW(TAG, "RMT: new tx channel with DMA failed (%d), retrying without DMA", rc);
             // Повторная попытка без DMA
             tx_cfg.flags.with_dma = 0;
-            tx_cfg.trans_queue_depth = 4;
             rc = rmt_new_tx_channel(&tx_cfg, &g_rmt_channel);
             if (rc != ESP_OK) {
                 ESP_LOGE(TAG, "RMT: new tx channel failed (%d)", rc);
@@ -201,6 +901,7 @@ static void init_pwm_from_globals(void)
             g_rmt_channel = NULL;
             return;
         }
+        g_rmt_channel_res_hz = tx_cfg.resolution_hz;
         // включение канала
         rmt_enable(g_rmt_channel);
 
@@ -219,23 +920,137 @@ static void init_pwm_from_globals(void)
     g_use_rmt = true;
 }
 
+// Задача применения: одно применение на всю пачку запросов. Таймер планировщика и
+// консоль только будят ее, поэтому снимок параметров и перенастройка LEDC выполняются
+// в одной задаче, а не в общей задаче esp_timer и не параллельно из двух мест.
+static void reconfig_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        portENTER_CRITICAL(&g_reconfig_mux);
+        g_reconfig_first_us = 0;
+        g_reconfig_last_apply_us = esp_timer_get_time();
+        portEXIT_CRITICAL(&g_reconfig_mux);
+        g_reconfig_applies++;
+        update_pwm_from_globals();
+    }
+}
+
+// Срабатывание таймера планировщика (задача esp_timer): только пробуждение задачи применения
+static void reconfig_timer_cb(void *arg)
+{
+    if (g_reconfig_task) xTaskNotifyGive(g_reconfig_task);
+}
+
+static void reconfig_init(void)
+{
+    xTaskCreatePinnedToCore(reconfig_task, "reconfig", 3072, NULL, 6, &g_reconfig_task, 0);
+
+    esp_timer_create_args_t args = {
+        .callback = reconfig_timer_cb,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "reconfig",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&args, &g_reconfig_timer) != ESP_OK) {
+        ESP_LOGW(TAG, "Reconfig timer create failed, settings will apply immediately");
+        g_reconfig_timer = NULL;
+    }
+}
+
+// Настройки генератора в одном блоке: общий формат для /submit и бинарной консоли
+typedef struct {
+    int pulses_per_rev;
+    uint32_t rpm_milli;
+    int pulse_pct;
+    bool enabled;
+    uint32_t fast_freq;
+    int fast_pct;
+    bool fast_enabled;
+    int trig_mode;
+    bool follow;
+    follow_cfg_t follow_cfg;
+    bool enc;
+    enc_cfg_t enc_cfg;
+} gen_settings_t;
+
+// Запрос перенастройки после изменения глобальных параметров. Применение откладывается
+// на RECONFIG_COALESCE_MS после последнего запроса, но не дольше RECONFIG_MAX_DELAY_MS
+// от первого и не чаще RECONFIG_MIN_INTERVAL_MS. Возвращает тикет для GET /status?ticket=N.
+static uint32_t reconfig_request(void)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&g_reconfig_mux);
+    uint32_t ticket = ++g_cfg_requested;
+    if (g_reconfig_first_us == 0) {
+        g_reconfig_first_us = now;
+    } else {
+        g_reconfig_merged++;
+    }
+    int64_t due = now + (int64_t)RECONFIG_COALESCE_MS * 1000;
+    int64_t latest = g_reconfig_first_us + (int64_t)RECONFIG_MAX_DELAY_MS * 1000;
+    int64_t earliest = g_reconfig_last_apply_us + (int64_t)RECONFIG_MIN_INTERVAL_MS * 1000;
+    if (due > latest) due = latest;
+    if (due < earliest) due = earliest;
+    portEXIT_CRITICAL(&g_reconfig_mux);
+
+    if (!g_reconfig_timer) {
+        reconfig_timer_cb(NULL);
+        return ticket;
+    }
+    // перезапуск таймера переносит применение; уже сработавший таймер подхватит этот тикет
+    esp_timer_stop(g_reconfig_timer);
+    int64_t delay_us = due - now;
+    if (delay_us < 1) delay_us = 1;
+    esp_timer_start_once(g_reconfig_timer, (uint64_t)delay_us);
+    return ticket;
+}
+
+// Немедленное применение без окна объединения (консоль): задача применения будится сразу;
+// отложенные запросы HTTP уже записаны в глобальные переменные и входят в этот же снимок.
+static uint32_t reconfig_apply_now(void)
+{
+    portENTER_CRITICAL(&g_reconfig_mux);
+    uint32_t ticket = ++g_cfg_requested;
+    portEXIT_CRITICAL(&g_reconfig_mux);
+    if (g_reconfig_timer) esp_timer_stop(g_reconfig_timer);
+    reconfig_timer_cb(NULL);
+    return ticket;
+}
+
+// Перенос глобальных настроек в примененные параметры (вызывается под g_param_lock)
+static void params_copy_from_globals(void)
+{
+    g_params.pulses_per_rev = g_pulses_per_rev;
+    g_params.pulse_us = g_pulse_us;
+    g_params.pause_us = g_pause_us;
+    g_params.pulse_pct = g_pulse_percent;
+    g_params.rpm_milli = g_rpm_milli;
+    g_params.enabled = g_output_enabled;
+    g_params.trig_mode = g_trig_mode;
+    g_params.follow = g_follow_enabled;
+    g_params.follow_cfg = g_follow;
+    g_params.enc = g_enc_enabled;
+    g_params.enc_cfg = g_enc;
+    g_params.seq_len = g_seq_len;
+    memcpy(g_params.seq_prog, g_seq_prog, g_seq_len * sizeof(seq_insn_t));
+}
+
 static void update_pwm_from_globals(void)
 {
     // Атомарное обновление снимка параметров и уведомление задачи RMT
     if (!g_param_lock) {
         // запасной вариант: гарантируем инициализацию
         init_pwm_from_globals();
-        if (g_rmt_task) xTaskNotify(g_rmt_task, 0x80000000, eSetBits);
+        if (g_rmt_task) xTaskNotify(g_rmt_task, RMT_NOTIFY_RECONFIG, eSetBits);
         return;
     }
 
     if (xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(100)) == pdTRUE) {
-        g_params.pulses_per_rev = g_pulses_per_rev;
-        g_params.pulse_us = g_pulse_us;
-        g_params.pause_us = g_pause_us;
-        g_params.pulse_pct = g_pulse_percent;
-        g_params.rpm = g_rpm;
-        g_params.enabled = g_output_enabled;
+        params_copy_from_globals();
+        // глобальные переменные записываются до выдачи тикета, поэтому снимок покрывает все выданные версии
+        g_params.version = g_cfg_requested;
         xSemaphoreGive(g_param_lock);
     }
 
@@ -243,7 +1058,7 @@ static void update_pwm_from_globals(void)
     if (!g_rmt_task) init_pwm_from_globals();
     if (g_rmt_task) {
         // Уведомляем задачу RMT об изменении конфигурации, используя специальный бит (старший бит)
-        xTaskNotify(g_rmt_task, 0x80000000, eSetBits);
+        xTaskNotify(g_rmt_task, RMT_NOTIFY_RECONFIG, eSetBits);
     }
 
     // Обновляем быстрый (LEDC) ШИМ из глобальных переменных
@@ -258,7 +1073,7 @@ static void init_fast_pwm(void)
         .speed_mode = g_ledc_mode,
         .timer_num = g_ledc_timer,
         .duty_resolution = LEDC_TIMER_9_BIT,
-        .freq_hz = (int)g_fast_freq_hz,
+        .freq_hz = g_fast_freq_hz,
         .clk_cfg = LEDC_AUTO_CLK,
     };
     ledc_timer_config(&tcfg);
@@ -278,7 +1093,7 @@ static void init_fast_pwm(void)
 // Обновление параметров LEDC (частота, скважность) из глобальных переменных (потокобезопасный снимок)
 static void update_fast_pwm_from_globals(void)
 {
-    double freq = g_fast_freq_hz;
+    uint32_t freq = g_fast_freq_hz;
     int pct = g_fast_pulse_pct;
     bool enabled = g_fast_enabled;
 
@@ -291,8 +1106,8 @@ static void update_fast_pwm_from_globals(void)
     }
 
     // ограничение значений
-    if (freq < 100.0) freq = 100.0;
-    if (freq > 100000.0) freq = 100000.0;
+    if (freq < 100) freq = 100;
+    if (freq > 100000) freq = 100000;
     if (pct < 1) pct = 1;
     if (pct > 99) pct = 99;
 
@@ -301,7 +1116,7 @@ static void update_fast_pwm_from_globals(void)
         .speed_mode = g_ledc_mode,
         .timer_num = g_ledc_timer,
         .duty_resolution = LEDC_TIMER_9_BIT,
-        .freq_hz = (int)freq,
+        .freq_hz = freq,
         .clk_cfg = LEDC_AUTO_CLK,
     };
     ledc_timer_config(&tcfg);
@@ -336,21 +1151,105 @@ static void url_decode(char *src)
     *dst = '\0';
 }
 
-// Разбор тела формы с "pulses=<int>&rpm=<double>" и обновление глобальных переменных
-static void handle_frequency_body(char *body)
+// Проверка и применение набора настроек (общий путь для /submit и консоли).
+// immediate=true — без окна объединения. Возвращает тикет или 0, если настройки отклонены.
+static uint32_t apply_settings(gen_settings_t *st, bool immediate)
+{
+    // Применение ограничений
+    if (st->pulses_per_rev <= 0) st->pulses_per_rev = 1;
+    if (st->pulses_per_rev > 10) st->pulses_per_rev = 10; // макс. импульсов
+    if (st->trig_mode < TRIG_MODE_OFF || st->trig_mode > TRIG_MODE_RESYNC) st->trig_mode = TRIG_MODE_OFF;
+    if (st->follow_cfg.in_teeth < 1) st->follow_cfg.in_teeth = 1;
+    if (st->follow_cfg.in_teeth > FOLLOW_MAX_TEETH) st->follow_cfg.in_teeth = FOLLOW_MAX_TEETH;
+    if (st->follow_cfg.mul < 1) st->follow_cfg.mul = 1;
+    if (st->follow_cfg.mul > FOLLOW_MAX_RATIO) st->follow_cfg.mul = FOLLOW_MAX_RATIO;
+    if (st->follow_cfg.div < 1) st->follow_cfg.div = 1;
+    if (st->follow_cfg.div > FOLLOW_MAX_RATIO) st->follow_cfg.div = FOLLOW_MAX_RATIO;
+    if (st->enc_cfg.lines < 1) st->enc_cfg.lines = 1;
+    if (st->enc_cfg.lines > ENC_MAX_LINES) st->enc_cfg.lines = ENC_MAX_LINES;
+    st->enc_cfg.dir = (st->enc_cfg.dir != 0) ? 1 : 0;
+    if (st->rpm_milli == 0) {
+        ESP_LOGW(TAG, "Invalid RPM");
+        return 0;
+    }
+    if (st->rpm_milli > RPM_MILLI_MAX) st->rpm_milli = RPM_MILLI_MAX; // макс. об/мин
+    // Уставка энкодера проверяется здесь: непредставимая отклоняется, а не повторяется задачей RMT.
+    // Режим внешнего запуска сохраняется, но пока включен энкодер, вход запуска не действует.
+    enc_plan_t enc_check;
+    if (st->enc && !enc_plan(&st->enc_cfg, st->rpm_milli, &enc_check)) {
+        ESP_LOGW(TAG, "ENC: %d lines at rpm=%u.%03u not representable", st->enc_cfg.lines,
+                 (unsigned)(st->rpm_milli / 1000U), (unsigned)(st->rpm_milli % 1000U));
+        return 0;
+    }
+
+    uint32_t rpm_milli = st->rpm_milli;
+    uint32_t pulse = 0;
+    uint32_t pause = 0;
+    uint32_t total = 0;
+    uint32_t freq_mhz = 0;
+    if (!compute_pulse_timing(st->pulses_per_rev, rpm_milli, st->pulse_pct, &pulse, &pause, &total, &freq_mhz)) {
+        ESP_LOGW(TAG, "Computed invalid timing from rpm=%u.%03u pulses=%d pct=%d",
+                 (unsigned)(rpm_milli / 1000U), (unsigned)(rpm_milli % 1000U), st->pulses_per_rev, st->pulse_pct);
+        return 0;
+    }
+
+    g_pulse_us = pulse;
+    g_pause_us = pause;
+    g_pulses_per_rev = st->pulses_per_rev;
+    g_rpm_milli = rpm_milli;
+    g_pulse_percent = st->pulse_pct;
+    g_output_enabled = st->enabled;
+    g_trig_mode = st->trig_mode;
+    if (g_param_lock && xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(100)) == pdTRUE) {
+        g_follow = st->follow_cfg;
+        g_enc = st->enc_cfg;
+        xSemaphoreGive(g_param_lock);
+    }
+    g_follow_enabled = st->follow;
+    g_enc_enabled = st->enc;
+
+    // применение параметров быстрого ШИМ
+    g_fast_freq_hz = st->fast_freq;
+    g_fast_pulse_pct = st->fast_pct;
+    g_fast_enabled = st->fast_enabled;
+
+    // Обновление аппаратного ШИМ на новую частоту/скважность
+    uint32_t ticket = immediate ? reconfig_apply_now() : reconfig_request();
+
+    // Сохранение новых настроек
+    if (save_settings() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save settings to NVS");
+    }
+
+    ESP_LOGI(TAG, "Set rpm=%u.%03u, pulses_per_rev=%d -> freq=%u.%03u Hz, period=%u us, pulse=%u us, pause=%u us",
+             (unsigned)(rpm_milli / 1000U), (unsigned)(rpm_milli % 1000U), st->pulses_per_rev,
+             (unsigned)(freq_mhz / 1000U), (unsigned)(freq_mhz % 1000U), (unsigned)total, (unsigned)pulse, (unsigned)pause);
+    return ticket;
+}
+
+// Разбор тела формы /submit ("pulses=<int>&rpm=<decimal>&...") и запрос перенастройки.
+// Возвращает тикет или 0, если параметры отклонены.
+static uint32_t handle_frequency_body(char *body)
 {
-    if (!body) return;
+    if (!body) return 0;
     // Сначала URL-декодируем все тело
     url_decode(body);
 
-    int pulses_per_rev = 1; // по умолчанию
-    double rpm = 0.0;
-    int pulse_pct = 10; // процент по умолчанию
-    bool enabled = true;
-    // настройки быстрого ШИМ по умолчанию
-    double fast_freq = g_fast_freq_hz;
-    int fast_pct = g_fast_pulse_pct;
-    bool fast_enabled = g_fast_enabled;
+    gen_settings_t st = {
+        .pulses_per_rev = 1, // по умолчанию
+        .rpm_milli = 0,
+        .pulse_pct = 10, // процент по умолчанию
+        .enabled = true,
+        // настройки быстрого ШИМ по умолчанию
+        .fast_freq = g_fast_freq_hz,
+        .fast_pct = g_fast_pulse_pct,
+        .fast_enabled = g_fast_enabled,
+        .trig_mode = g_trig_mode,
+        .follow = g_follow_enabled,
+        .follow_cfg = g_follow,
+        .enc = g_enc_enabled,
+        .enc_cfg = g_enc,
+    };
 
     // Разделение пар ключ=значение, разделенных '&'
     char *pair = strtok(body, "&");
@@ -361,64 +1260,41 @@ static void handle_frequency_body(char *body)
             char *key = pair;
             char *val = eq + 1;
             if (strcmp(key, "pulses") == 0) {
-                pulses_per_rev = atoi(val);
+                st.pulses_per_rev = atoi(val);
             } else if (strcmp(key, "rpm") == 0) {
-                rpm = atof(val);
+                if (!parse_fixed_milli(val, &st.rpm_milli)) st.rpm_milli = 0;
             } else if (strcmp(key, "pulse_pct") == 0) {
-                pulse_pct = atoi(val);
+                st.pulse_pct = atoi(val);
             } else if (strcmp(key, "fast_freq") == 0) {
-                fast_freq = atof(val);
+                st.fast_freq = (uint32_t)strtoul(val, NULL, 10);
             } else if (strcmp(key, "fast_pct") == 0) {
-                fast_pct = atoi(val);
+                st.fast_pct = atoi(val);
             } else if (strcmp(key, "fast_enabled") == 0) {
-                fast_enabled = (atoi(val) != 0);
+                st.fast_enabled = (atoi(val) != 0);
             } else if (strcmp(key, "enabled") == 0) {
-                enabled = (atoi(val) != 0);
+                st.enabled = (atoi(val) != 0);
+            } else if (strcmp(key, "trig") == 0) {
+                st.trig_mode = atoi(val);
+            } else if (strcmp(key, "follow") == 0) {
+                st.follow = (atoi(val) != 0);
+            } else if (strcmp(key, "in_teeth") == 0) {
+                st.follow_cfg.in_teeth = atoi(val);
+            } else if (strcmp(key, "mul") == 0) {
+                st.follow_cfg.mul = atoi(val);
+            } else if (strcmp(key, "div") == 0) {
+                st.follow_cfg.div = atoi(val);
+            } else if (strcmp(key, "enc") == 0) {
+                st.enc = (atoi(val) != 0);
+            } else if (strcmp(key, "enc_lines") == 0) {
+                st.enc_cfg.lines = atoi(val);
+            } else if (strcmp(key, "enc_dir") == 0) {
+                st.enc_cfg.dir = atoi(val);
             }
         }
         pair = strtok(NULL, "&");
     }
 
-    // Применение ограничений
-    if (pulses_per_rev <= 0) pulses_per_rev = 1;
-    if (pulses_per_rev > 10) pulses_per_rev = 10; // макс. импульсов
-    if (rpm <= 0.0) {
-        ESP_LOGW(TAG, "Invalid RPM: %.3f", rpm);
-        return;
-    }
-    if (rpm > 1000.0) rpm = 1000.0; // макс. об/мин
-
-    uint32_t pulse = 0;
-    uint32_t pause = 0;
-    uint32_t total = 0;
-    double freq = 0.0;
-    if (!compute_pulse_timing(pulses_per_rev, rpm, pulse_pct, &pulse, &pause, &total, &freq)) {
-        ESP_LOGW(TAG, "Computed invalid timing from rpm=%.3f pulses=%d pct=%d", rpm, pulses_per_rev, pulse_pct);
-        return;
-    }
-
-    g_pulse_us = pulse;
-    g_pause_us = pause;
-    g_pulses_per_rev = pulses_per_rev;
-    g_rpm = rpm;
-    g_pulse_percent = pulse_pct;
-    g_output_enabled = enabled;
-
-    // применение параметров быстрого ШИМ
-    g_fast_freq_hz = fast_freq;
-    g_fast_pulse_pct = fast_pct;
-    g_fast_enabled = fast_enabled;
-
-    // Обновление аппаратного ШИМ на новую частоту/скважность
-    update_pwm_from_globals();
-
-    // Сохранение новых настроек
-    if (save_settings() != ESP_OK) {
-        ESP_LOGW(TAG, "Failed to save settings to NVS");
-    }
-
-    ESP_LOGI(TAG, "Set rpm=%.3f, pulses_per_rev=%d -> freq=%.3f Hz, period=%u us, pulse=%u us, pause=%u us",
-             rpm, pulses_per_rev, freq, total, pulse, pause);
+    return apply_settings(&st, false);
 }
 
 // Статический HTML для экономии RAM (без больших malloc) и Flash (без кода форматирования snprintf)
@@ -437,6 +1313,7 @@ static const char INDEX_HTML[] =
     "button.ghost{background:transparent;border:1px solid rgba(255,255,255,0.06);color:#cfe8f3;padding:10px;border-radius:10px;width:100%;cursor:pointer;margin-top:10px}"
     ".presets{display:flex;gap:8px;flex-wrap:wrap}button.preset{flex:1;padding:10px;border-radius:10px;background:rgba(255,255,255,0.03);border:none;color:#d8eef8;cursor:pointer}"
     ".status{display:flex;justify-content:space-between;gap:8px;padding:8px;background:rgba(255,255,255,0.02);border-radius:8px;font-size:14px;margin-bottom:8px}"
+    ".wave{width:100%;height:80px;background:rgba(255,255,255,0.02);border-radius:8px;display:block}.wave-info{font-size:12px;color:#8fb0cf;text-align:right;margin:4px 0 8px}"
     ".fast-info{background:rgba(6,182,212,0.1);color:#22d3ee;padding:10px;border-radius:8px;text-align:center;font-weight:bold;margin-bottom:8px}"
     "footer{font-size:12px;color:#8fb0cf;text-align:center;margin-top:20px}" 
     "@media(min-width:520px){.wrap{padding:28px}.card{max-width:520px;margin:0 auto}}"
@@ -453,6 +1330,7 @@ static const char INDEX_HTML[] =
     "<div class=big-row><input id=pulse_pct_range type=range min=1 max=99 step=1 value=\"10\"><input id=pulse_pct_num type=number min=1 max=99 value=\"10\"></div>"
     "<div class=presets><button type=button class=preset onclick=pickD(5)>5%</button><button type=button class=preset onclick=pickD(10)>10%</button><button type=button class=preset onclick=pickD(20)>20%</button><button type=button class=preset onclick=pickD(50)>50%</button></div></div>"
     "<div class=status><div>Имп: <strong id=status_p>--</strong></div><div>RPM: <strong id=status_r>--</strong></div><div>Hz: <strong id=status_f>--</strong></div><div>%: <strong id=status_d>--</strong></div></div>"
+    "<canvas id=wave class=wave width=480 height=80></canvas><div id=wave_info class=wave-info>--</div>"
     "<button id=apply_btn_slow class=primary>Применить (Медленный)</button>"
     "</div>"
     "<div style=\"height:20px\"></div>"
@@ -476,10 +1354,12 @@ static const char INDEX_HTML[] =
     "const statusP=document.getElementById('status_p'),statusR=document.getElementById('status_r'),statusF=document.getElementById('status_f'),statusD=document.getElementById('status_d');"
     "const applyBtnSlow=document.getElementById('apply_btn_slow'),applyBtnFast=document.getElementById('apply_btn_fast'),resetBtn=document.getElementById('reset_btn'),enabledCb=document.getElementById('enabled_cb'),enabledFastCb=document.getElementById('enabled_fast_cb');"
     "const fastStatusTxt=document.getElementById('fast_status_txt');"
+    "const wave=document.getElementById('wave'),waveInfo=document.getElementById('wave_info'); let frameVer=-1;"
+    "async function fetchFrame(){try{let r=await fetch('/frame',{cache:'no-store'}); const x=wave.getContext('2d'),w=wave.width,h=wave.height; x.clearRect(0,0,w,h); if(r.status!==200){waveInfo.textContent='--'; return;} const b=new DataView(await r.arrayBuffer()); let segs=[],tot=0; for(let i=0;i+3<b.byteLength;i+=4){const v=b.getUint32(i,true),d0=v&0x7fff,d1=(v>>>16)&0x7fff; if(d0){segs.push([(v>>>15)&1,d0]);tot+=d0;} if(d1){segs.push([v>>>31,d1]);tot+=d1;}} if(!tot) return; const y=l=>l?8:h-8; x.strokeStyle='#22d3ee'; x.lineWidth=2; x.beginPath(); x.moveTo(0,y(segs[0][0])); let t=0; for(const [l,d] of segs){x.lineTo(t/tot*w,y(l)); t+=d; x.lineTo(t/tot*w,y(l));} x.stroke(); const res=+r.headers.get('X-Frame-Res-Hz')||1e6,teeth=r.headers.get('X-Frame-Teeth'); waveInfo.textContent=(tot*1000/res).toFixed(3)+' мс, зубьев: '+teeth+(r.headers.get('X-Frame-Truncated')==='1'?' (кадр обрезан)':'');}catch(e){/*silent*/}}"
     "const freq_range=document.getElementById('freq_range'),freq_num=document.getElementById('freq_num'),pulse_pct_range_fast=document.getElementById('pulse_pct_range_fast'),pulse_pct_num_fast=document.getElementById('pulse_pct_num_fast');"
     "pulses_range.oninput=e=>pulses_num.value=e.target.value; pulses_num.oninput=e=>pulses_range.value=e.target.value; rpm_range.oninput=e=>rpm_num.value=e.target.value; rpm_num.oninput=e=>rpm_range.value=e.target.value; pulse_pct_range.oninput=e=>pulse_pct_num.value=e.target.value; pulse_pct_num.oninput=e=>pulse_pct_range.value=e.target.value; freq_range.oninput=e=>freq_num.value=e.target.value; freq_num.oninput=e=>freq_range.value=e.target.value; pulse_pct_range_fast.oninput=e=>pulse_pct_num_fast.value=e.target.value; pulse_pct_num_fast.oninput=e=>pulse_pct_range_fast.value=e.target.value;"
     "function pickP(v){pulses_range.value=v; pulses_num.value=v;} function pickR(v){rpm_range.value=v; rpm_num.value=v;} function pickD(v){pulse_pct_range.value=v; pulse_pct_num.value=v;} function pickDF(v){pulse_pct_range_fast.value=v; pulse_pct_num_fast.value=v;} function resetDefaults(){pickP(1); pickR(60); pickD(10); pickDF(10); freq_range.value=1000; freq_num.value=1000;}"
-    "async function fetchStatus(){try{let r=await fetch('/status',{cache:'no-store'}); if(r.ok){let j=await r.json(); statusP.textContent=j.pulses; statusR.textContent=j.rpm; statusF.textContent=j.freq.toFixed(3); statusD.textContent=(j.pulse_pct!==undefined?j.pulse_pct:'--'); if(document.activeElement!==enabledCb){ enabledCb.checked=j.enabled; updateControlsVisibility(); } if(document.activeElement!==enabledFastCb){ enabledFastCb.checked=j.fast_enabled; updateControlsVisibility(); } fastStatusTxt.textContent=(j.fast_freq!==undefined?j.fast_freq:'--')+' Hz, '+(j.fast_pct!==undefined?j.fast_pct:'--')+'%'; } }catch(e){/*silent*/}}"
+    "async function fetchStatus(){try{let r=await fetch('/status',{cache:'no-store'}); if(r.ok){let j=await r.json(); statusP.textContent=j.pulses; statusR.textContent=j.rpm; statusF.textContent=j.freq.toFixed(3); statusD.textContent=(j.pulse_pct!==undefined?j.pulse_pct:'--'); if(document.activeElement!==enabledCb){ enabledCb.checked=j.enabled; updateControlsVisibility(); } if(document.activeElement!==enabledFastCb){ enabledFastCb.checked=j.fast_enabled; updateControlsVisibility(); } fastStatusTxt.textContent=(j.fast_freq!==undefined?j.fast_freq:'--')+' Hz, '+(j.fast_pct!==undefined?j.fast_pct:'--')+'%'; if(j.frame_ver!==undefined&&j.frame_ver!==frameVer){frameVer=j.frame_ver; fetchFrame();} } }catch(e){/*silent*/}}"
     "function updateControlsVisibility(){const ctr=document.getElementById('controls');const fctr=document.getElementById('fast_controls'); if(!ctr||!fctr) return; if(enabledCb.checked){ctr.style.display='';}else{ctr.style.display='none';} if(enabledFastCb.checked){fctr.style.display='';}else{fctr.style.display='none';}}"
     "let poll = setInterval(fetchStatus,1500); document.addEventListener('visibilitychange',()=>{ if(document.hidden) clearInterval(poll); else {fetchStatus(); poll=setInterval(fetchStatus,1500);} }); document.addEventListener('DOMContentLoaded',fetchStatus);"
     "async function applySettings(e){const btn=e.target; const oldTxt=btn.textContent; btn.disabled=true; btn.textContent='Применение...'; const body = new URLSearchParams(); body.append('pulses',pulses_num.value); body.append('rpm',rpm_num.value); body.append('pulse_pct',pulse_pct_num.value); body.append('enabled',enabledCb.checked?1:0); body.append('fast_freq',freq_num.value); body.append('fast_pct',pulse_pct_num_fast.value); body.append('fast_enabled',enabledFastCb.checked?1:0); try{let r=await fetch('/submit',{method:'POST',body:body,headers:{'Content-Type':'application/x-www-form-urlencoded'}}); let j=await r.json(); if(j.status==='ok'){btn.textContent='Применено'; fetchStatus(); setTimeout(()=>btn.textContent=oldTxt,900);} else {btn.textContent='Ошибка'; setTimeout(()=>btn.textContent=oldTxt,1500);} }catch(err){btn.textContent='Ошибка'; setTimeout(()=>btn.textContent=oldTxt,1500);} finally{btn.disabled=false;} }"
@@ -521,14 +1401,18 @@ static esp_err_t submit_post_handler(httpd_req_t *req)
     buf[recv_len] = '\0';
 
     // обработка параметров
-    handle_frequency_body(buf);
+    uint32_t ticket = handle_frequency_body(buf);
 
     // Формирование JSON-ответа с текущими настройками
-    double freq = (g_rpm / 60.0) * (double)g_pulses_per_rev;
+    uint32_t rpm_milli = g_rpm_milli;
+    uint32_t freq_mhz = (rpm_milli * (uint32_t)g_pulses_per_rev + 30U) / 60U;
     char json[256];
-    int n = snprintf(json, sizeof(json), "{\"status\":\"ok\",\"pulses\":%d,\"rpm\":%.1f,\"freq\":%.3f,\"pulse_pct\":%d,\"enabled\":%d,\"fast_freq\":%.1f,\"fast_pct\":%d,\"fast_enabled\":%d}",
-                     g_pulses_per_rev, g_rpm, freq, g_pulse_percent, g_output_enabled, g_fast_freq_hz, g_fast_pulse_pct, g_fast_enabled);
+    int n = snprintf(json, sizeof(json), "{\"status\":\"%s\",\"ticket\":%u,\"pulses\":%d,\"rpm\":%u.%03u,\"freq\":%u.%03u,\"pulse_pct\":%d,\"enabled\":%d,\"fast_freq\":%u,\"fast_pct\":%d,\"fast_enabled\":%d}",
+                     ticket ? "ok" : "error", (unsigned)ticket, g_pulses_per_rev, (unsigned)(rpm_milli / 1000U), (unsigned)(rpm_milli % 1000U),
+                     (unsigned)(freq_mhz / 1000U), (unsigned)(freq_mhz % 1000U), g_pulse_percent, g_output_enabled,
+                     (unsigned)g_fast_freq_hz, g_fast_pulse_pct, g_fast_enabled);
 
+    if (!ticket) httpd_resp_set_status(req, "400 Bad Request");
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, json, n);
 
@@ -536,240 +1420,1405 @@ static esp_err_t submit_post_handler(httpd_req_t *req)
 }
 
 // GET /status -> возвращает текущие настройки в формате JSON
+// GET /status?ticket=N — ответ сразу, ticket_done показывает, подхватил ли генератор
+// версию N; settling — выход еще держится в нуле в паузе перестройки.
 static esp_err_t status_get_handler(httpd_req_t *req)
 {
-    char json[192];
-    double freq = (g_rpm / 60.0) * (double)g_pulses_per_rev;
-    int n = snprintf(json, sizeof(json), "{\"pulses\":%d,\"rpm\":%.1f,\"freq\":%.3f,\"pulse_pct\":%d,\"enabled\":%d,\"fast_freq\":%.1f,\"fast_pct\":%d,\"fast_enabled\":%d}",
-                     g_pulses_per_rev, g_rpm, freq, g_pulse_percent, g_output_enabled, g_fast_freq_hz, g_fast_pulse_pct, g_fast_enabled);
+    // ticket_done: генератор взял снимок с версией не младше N (клиент опрашивает повторно)
+    char query[32];
+    char val[12];
+    int ticket_done = -1;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "ticket", val, sizeof(val)) == ESP_OK) {
+        uint32_t want = (uint32_t)strtoul(val, NULL, 10);
+        ticket_done = ((int32_t)(g_cfg_applied - want) >= 0) ? 1 : 0;
+    }
+
+    char json[1280];
+    uint32_t rpm_milli = g_rpm_milli;
+    uint32_t in_freq_mhz = cap_input_freq_mhz();
+    uint32_t frame_err_ppb = g_frame_err_ppb;
+    uint32_t enc_err_ppb = g_enc_err_ppb;
+    uint32_t freq_mhz = (rpm_milli * (uint32_t)g_pulses_per_rev + 30U) / 60U;
+    int n = snprintf(json, sizeof(json), "{\"pulses\":%d,\"rpm\":%u.%03u,\"freq\":%u.%03u,\"pulse_pct\":%d,\"enabled\":%d,\"fast_freq\":%u,\"fast_pct\":%d,\"fast_enabled\":%d,\"seq\":%u,\"seq_sps\":%u,\"seq_end\":%u,"
+                     "\"trig\":%d,\"trig_count\":%u,\"trig_lat_us\":%u,\"trig_lat_min_us\":%u,\"trig_lat_max_us\":%u,"
+                     "\"follow\":%d,\"in_teeth\":%d,\"mul\":%d,\"div\":%d,\"in_freq\":%u.%03u,"
+                     "\"cache_hits\":%u,\"cache_misses\":%u,\"res_hz\":%u,\"symbols\":%u,\"err_ppm\":%u.%03u,"
+                     "\"frame_ver\":%u,\"truncated\":%d,\"reps\":%u,"
+                     "\"queue\":%u,\"underruns\":%u,\"queue_adjusts\":%u,\"refill_lat_us\":%u,\"refill_peak_us\":%u,\"frame_min_us\":%u,"
+                     "\"cfg_ver\":%u,\"cfg_applied\":%u,\"cfg_applies\":%u,\"cfg_merged\":%u,\"settling\":%d,\"ticket_done\":%d,"
+                     "\"enc\":%d,\"enc_lines\":%d,\"enc_dir\":%d,\"enc_res_hz\":%u,\"enc_err_ppm\":%u.%03u}",
+                     g_pulses_per_rev, (unsigned)(rpm_milli / 1000U), (unsigned)(rpm_milli % 1000U),
+                     (unsigned)(freq_mhz / 1000U), (unsigned)(freq_mhz % 1000U), g_pulse_percent, g_output_enabled,
+                     (unsigned)g_fast_freq_hz, g_fast_pulse_pct, g_fast_enabled,
+                     (unsigned)g_seq_len, (unsigned)g_seq_symbols_per_sec, (unsigned)g_seq_end,
+                     g_trig_mode, (unsigned)g_trig_count, (unsigned)g_trig_lat_last_us, (unsigned)g_trig_lat_min_us, (unsigned)g_trig_lat_max_us,
+                     g_follow_enabled, g_follow.in_teeth, g_follow.mul, g_follow.div,
+                     (unsigned)(in_freq_mhz / 1000U), (unsigned)(in_freq_mhz % 1000U),
+                     (unsigned)g_frame_cache_hits, (unsigned)g_frame_cache_misses,
+                     (unsigned)g_frame_res_hz, (unsigned)g_frame_symbols, (unsigned)(frame_err_ppb / 1000U), (unsigned)(frame_err_ppb % 1000U),
+                     (unsigned)g_frame_version, g_frame_truncated, (unsigned)g_frame_reps,
+                     (unsigned)g_rmt_queue_target, (unsigned)g_rmt_underruns, (unsigned)g_rmt_queue_adjusts,
+                     (unsigned)g_rmt_refill_lat_us, (unsigned)g_rmt_refill_peak_us, (unsigned)g_rmt_frame_min_us,
+                     (unsigned)g_cfg_requested, (unsigned)g_cfg_applied, (unsigned)g_reconfig_applies, (unsigned)g_reconfig_merged,
+                     g_rmt_settling, ticket_done,
+                     g_enc_enabled, g_enc.lines, g_enc.dir, (unsigned)g_enc_res_hz, (unsigned)(enc_err_ppb / 1000U), (unsigned)(enc_err_ppb % 1000U));
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, json, n);
     return ESP_OK;
 }
 
-// Сохранение настроек в NVS
-static esp_err_t save_settings(void)
+// POST /program - загрузка программы секвенсора (двоичный образ, SEQ_INSN_WIRE_SIZE байт на инструкцию).
+// Пустое тело выгружает программу и возвращает обычный режим генерации.
+static esp_err_t program_post_handler(httpd_req_t *req)
 {
-    // Запись во Flash отключена по запросу пользователя — не сохраняем в NVS.
+    static uint8_t buf[SEQ_MAX_INSNS * SEQ_INSN_WIRE_SIZE];
+    static seq_insn_t prog[SEQ_MAX_INSNS];
+
+    int total_len = req->content_len;
+    if (total_len < 0 || total_len > (int)sizeof(buf)) {
+        const char *err = "{\"status\":\"error\",\"msg\":\"program too large\"}";
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, err, HTTPD_RESP_USE_STRLEN);
+        return ESP_FAIL;
+    }
+
+    int ret = 0, recv_len = 0;
+    while (recv_len < total_len) {
+        ret = httpd_req_recv(req, (char *)buf + recv_len, total_len - recv_len);
+        if (ret <= 0) {
+            const char *err = "{\"status\":\"error\",\"msg\":\"recv failed\"}";
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_send(req, err, HTTPD_RESP_USE_STRLEN);
+            return ESP_FAIL;
+        }
+        recv_len += ret;
+    }
+
+    uint16_t len = 0;
+    const char *msg = NULL;
+    if (!seq_program_decode(buf, (size_t)recv_len, prog, &len)) {
+        msg = "bad program size";
+    } else if (len > 0) {
+        seq_program_validate(prog, len, &msg);
+    }
+
+    char json[96];
+    int n;
+    if (msg) {
+        n = snprintf(json, sizeof(json), "{\"status\":\"error\",\"msg\":\"%s\"}", msg);
+    } else {
+        if (g_param_lock && xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(100)) == pdTRUE) {
+            memcpy(g_seq_prog, prog, len * sizeof(seq_insn_t));
+            g_seq_len = len;
+            xSemaphoreGive(g_param_lock);
+            // программа входит в примененные параметры вместе с остальной пачкой запросов
+            uint32_t ticket = reconfig_request();
+            ESP_LOGI(TAG, "SEQ: loaded program, %u instructions", (unsigned)len);
+            n = snprintf(json, sizeof(json), "{\"status\":\"ok\",\"insns\":%u,\"ticket\":%u}", (unsigned)len, (unsigned)ticket);
+        } else {
+            n = snprintf(json, sizeof(json), "{\"status\":\"error\",\"msg\":\"busy\"}");
+        }
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, n);
     return ESP_OK;
 }
 
-// Задача передачи RMT: непрерывно отправляет последовательности импульсов, пока g_use_rmt = true
-// Callback завершения передачи RMT — уведомляет задачу передачи о необходимости пополнить очередь
-static bool IRAM_ATTR rmt_tx_done_cb(rmt_channel_handle_t channel, const rmt_tx_done_event_data_t *edata, void *user_ctx)
+// GET /frame -> символы rmt_symbol_word_t передаваемого кадра (32 бита, little-endian),
+// отправляются прямо из буфера кэша без копирования. Заголовки: X-Frame-Version,
+// X-Frame-Res-Hz (тик), X-Frame-Teeth (зубьев в кадре), X-Frame-Truncated.
+// 204 — статического кадра нет (выход выключен, секвенсор или режим слежения).
+static esp_err_t frame_get_handler(httpd_req_t *req)
+{
+    portENTER_CRITICAL(&g_frame_mux);
+    frame_cache_entry_t *e = g_frame_published;
+    uint32_t version = g_frame_version;
+    if (e) e->readers++;
+    portEXIT_CRITICAL(&g_frame_mux);
+
+    char ver_hdr[12];
+    snprintf(ver_hdr, sizeof(ver_hdr), "%u", (unsigned)version);
+    httpd_resp_set_hdr(req, "X-Frame-Version", ver_hdr);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    if (!e) {
+        httpd_resp_set_status(req, "204 No Content");
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+
+    char res_hdr[12];
+    char teeth_hdr[12];
+    snprintf(res_hdr, sizeof(res_hdr), "%u", (unsigned)e->plan.res_hz);
+    snprintf(teeth_hdr, sizeof(teeth_hdr), "%u", (unsigned)e->plan.teeth);
+    httpd_resp_set_hdr(req, "X-Frame-Res-Hz", res_hdr);
+    httpd_resp_set_hdr(req, "X-Frame-Teeth", teeth_hdr);
+    httpd_resp_set_hdr(req, "X-Frame-Truncated", e->truncated ? "1" : "0");
+    httpd_resp_set_type(req, "application/octet-stream");
+    esp_err_t rc = httpd_resp_send(req, (const char *)e->items, (int)(e->count * sizeof(rmt_symbol_word_t)));
+
+    portENTER_CRITICAL(&g_frame_mux);
+    e->readers--;
+    portEXIT_CRITICAL(&g_frame_mux);
+    return rc;
+}
+
+// Поиск пресета по имени (вызывается под g_param_lock)
+static preset_t *preset_find(const char *name)
+{
+    for (int i = 0; i < PRESET_MAX; ++i) {
+        if (g_presets[i].used && strncmp(g_presets[i].name, name, PRESET_NAME_LEN) == 0) {
+            return &g_presets[i];
+        }
+    }
+    return NULL;
+}
+
+// POST /preset - "action=save|recall|delete&name=<имя>[&pulses=..&rpm=..&pulse_pct=..&pin=0|1]"
+// save без параметров сохраняет текущие настройки; pin=1 держит кадр пресета собранным в кэше.
+static esp_err_t preset_post_handler(httpd_req_t *req)
+{
+    char buf[256];
+    int total_len = req->content_len;
+    const char *msg = NULL;
+
+    if (total_len <= 0 || total_len >= (int)sizeof(buf)) {
+        msg = "empty body";
+    } else {
+        int ret = 0, recv_len = 0;
+        while (recv_len < total_len) {
+            ret = httpd_req_recv(req, buf + recv_len, total_len - recv_len);
+            if (ret <= 0) {
+                msg = "recv failed";
+                break;
+            }
+            recv_len += ret;
+        }
+        buf[recv_len] = '\0';
+    }
+
+    char action[8] = "";
+    char name[PRESET_NAME_LEN] = "";
+    int pulses = g_pulses_per_rev;
+    uint32_t rpm_milli = g_rpm_milli;
+    int pulse_pct = g_pulse_percent;
+    bool pin = false;
+
+    if (!msg) {
+        url_decode(buf);
+        char *pair = strtok(buf, "&");
+        while (pair) {
+            char *eq = strchr(pair, '=');
+            if (eq) {
+                *eq = '\0';
+                char *key = pair;
+                char *val = eq + 1;
+                if (strcmp(key, "action") == 0) {
+                    strncpy(action, val, sizeof(action) - 1);
+                } else if (strcmp(key, "name") == 0) {
+                    strncpy(name, val, sizeof(name) - 1);
+                } else if (strcmp(key, "pulses") == 0) {
+                    pulses = atoi(val);
+                } else if (strcmp(key, "rpm") == 0) {
+                    if (!parse_fixed_milli(val, &rpm_milli)) rpm_milli = 0;
+                } else if (strcmp(key, "pulse_pct") == 0) {
+                    pulse_pct = atoi(val);
+                } else if (strcmp(key, "pin") == 0) {
+                    pin = (atoi(val) != 0);
+                }
+            }
+            pair = strtok(NULL, "&");
+        }
+        if (name[0] == '\0') msg = "missing name";
+        // имя попадает в JSON без экранирования, поэтому допускаем только простые символы
+        for (const char *c = name; *c && !msg; ++c) {
+            if (!isalnum((unsigned char)*c) && *c != '_' && *c != '-') msg = "bad name";
+        }
+    }
+
+    if (pulses < 1) pulses = 1;
+    if (pulses > 10) pulses = 10;
+    if (pulse_pct < 1) pulse_pct = 1;
+    if (pulse_pct > 99) pulse_pct = 99;
+    if (rpm_milli > RPM_MILLI_MAX) rpm_milli = RPM_MILLI_MAX;
+
+    bool recall = false;
+    bool presets_changed = false;
+    uint32_t ticket = 0; // тикет перенастройки при вызове пресета
+    if (!msg && (!g_param_lock || xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(100)) != pdTRUE)) {
+        msg = "busy";
+    } else if (!msg) {
+        preset_t *p = preset_find(name);
+        if (strcmp(action, "save") == 0) {
+            int pinned = 0;
+            for (int i = 0; i < PRESET_MAX; ++i) {
+                if (g_presets[i].used && g_presets[i].pinned && &g_presets[i] != p) pinned++;
+            }
+            if (!p) {
+                for (int i = 0; i < PRESET_MAX && !p; ++i) {
+                    if (!g_presets[i].used) p = &g_presets[i];
+                }
+            }
+            if (!p) {
+                msg = "preset table full";
+            } else if (rpm_milli == 0) {
+                msg = "invalid rpm";
+            } else if (pin && pinned >= PRESET_PIN_MAX) {
+                msg = "too many pinned presets";
+            } else {
+                memset(p, 0, sizeof(*p));
+                strncpy(p->name, name, PRESET_NAME_LEN - 1);
+                p->pulses = pulses;
+                p->rpm_milli = rpm_milli;
+                p->pulse_pct = pulse_pct;
+                p->pinned = pin;
+                p->used = true;
+                presets_changed = true;
+            }
+        } else if (strcmp(action, "recall") == 0) {
+            if (!p) {
+                msg = "no such preset";
+            } else {
+                pulses = p->pulses;
+                rpm_milli = p->rpm_milli;
+                pulse_pct = p->pulse_pct;
+                recall = true;
+            }
+        } else if (strcmp(action, "delete") == 0) {
+            if (!p) {
+                msg = "no such preset";
+            } else {
+                memset(p, 0, sizeof(*p));
+                presets_changed = true;
+            }
+        } else {
+            msg = "unknown action";
+        }
+        xSemaphoreGive(g_param_lock);
+    }
+
+    // кадры закрепленных пресетов собираются здесь, а не в задаче RMT между пополнениями
+    if (!msg && presets_changed) frame_cache_sync_presets();
+
+    if (recall) {
+        uint32_t pulse = 0;
+        uint32_t pause = 0;
+        if (compute_pulse_timing(pulses, rpm_milli, pulse_pct, &pulse, &pause, NULL, NULL)) {
+            g_pulse_us = pulse;
+            g_pause_us = pause;
+            g_pulses_per_rev = pulses;
+            g_rpm_milli = rpm_milli;
+            g_pulse_percent = pulse_pct;
+            ticket = reconfig_request();
+            ESP_LOGI(TAG, "Recalled preset '%s'", name);
+        } else {
+            msg = "invalid preset timing";
+        }
+    }
+
+    char json[96];
+    int n;
+    if (msg) {
+        n = snprintf(json, sizeof(json), "{\"status\":\"error\",\"msg\":\"%s\"}", msg);
+    } else if (ticket) {
+        n = snprintf(json, sizeof(json), "{\"status\":\"ok\",\"ticket\":%u}", (unsigned)ticket);
+    } else {
+        n = snprintf(json, sizeof(json), "{\"status\":\"ok\"}");
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, n);
+    return msg ? ESP_FAIL : ESP_OK;
+}
+
+// GET /presets -> список пресетов и статистика кэша кадров
+static esp_err_t presets_get_handler(httpd_req_t *req)
+{
+    char json[PRESET_MAX * 96 + 128];
+    int n = snprintf(json, sizeof(json), "{\"cache_hits\":%u,\"cache_misses\":%u,\"cache_evictions\":%u,\"presets\":[",
+                     (unsigned)g_frame_cache_hits, (unsigned)g_frame_cache_misses, (unsigned)g_frame_cache_evictions);
+
+    if (g_param_lock && xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(100)) == pdTRUE) {
+        bool first = true;
+        for (int i = 0; i < PRESET_MAX; ++i) {
+            const preset_t *p = &g_presets[i];
+            if (!p->used) continue;
+            n += snprintf(json + n, sizeof(json) - n, "%s{\"name\":\"%s\",\"pulses\":%d,\"rpm\":%u.%03u,\"pulse_pct\":%d,\"pinned\":%d}",
+                          first ? "" : ",", p->name, p->pulses,
+                          (unsigned)(p->rpm_milli / 1000U), (unsigned)(p->rpm_milli % 1000U), p->pulse_pct, p->pinned);
+            first = false;
+        }
+        xSemaphoreGive(g_param_lock);
+    }
+    n += snprintf(json + n, sizeof(json) - n, "]}");
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, n);
+    return ESP_OK;
+}
+
+// Сохранение настроек в NVS
+static esp_err_t save_settings(void)
+{
+    // Запись во Flash отключена по запросу пользователя — не сохраняем в NVS.
+    return ESP_OK;
+}
+
+// Задача передачи RMT: непрерывно отправляет последовательности импульсов, пока g_use_rmt = true
+// Callback завершения передачи RMT — уведомляет задачу передачи о необходимости пополнить очередь
+static bool IRAM_ATTR rmt_tx_done_cb(rmt_channel_handle_t channel, const rmt_tx_done_event_data_t *edata, void *user_ctx)
 {
     BaseType_t high_task_wakeup = pdFALSE;
+    g_rmt_done_us = (uint32_t)esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&g_rmt_mux);
+    if (g_rmt_inflight > 0) g_rmt_inflight--;
+    g_rmt_done_total++;
+    // очередь опустела посреди непрерывной передачи: выход простаивает до следующей транзакции
+    if (g_rmt_inflight == 0 && g_rmt_streaming) g_rmt_underruns++;
+    portEXIT_CRITICAL_ISR(&g_rmt_mux);
     if (g_rmt_task) vTaskNotifyGiveFromISR(g_rmt_task, &high_task_wakeup);
     return high_task_wakeup == pdTRUE;
 }
 
-static void rmt_tx_task(void *arg)
+// Обработчик фронтов входа внешнего запуска. Останов выполняется прямо в ISR:
+// вывод отключается от RMT через GPIO-матрицу и удерживается в нуле, поэтому
+// выход гаснет за время входа в прерывание, не дожидаясь задачи RMT.
+static void IRAM_ATTR trig_isr(void *arg)
+{
+    int mode = g_params.trig_mode;
+    // в режиме энкодера SLOW_PWM занят каналом A, вход запуска не действует
+    if (mode == TRIG_MODE_OFF || g_params.enc || !g_rmt_task) return;
+
+    int64_t now = esp_timer_get_time();
+    BaseType_t high_task_wakeup = pdFALSE;
+    if (gpio_ll_get_level(&GPIO, TRIG_IN)) {
+        g_trig_edge_us = now;
+        g_trig_measure = true;
+        // прерывание по фронту выхода включено только на время одного измерения
+        gpio_ll_intr_enable_on_core(&GPIO, g_trig_isr_core, SLOW_PWM);
+        xTaskNotifyFromISR(g_rmt_task, RMT_NOTIFY_TRIG_START, eSetBits, &high_task_wakeup);
+    } else if (mode == TRIG_MODE_GATE) {
+        if (g_trig_armed) {
+            gpio_ll_set_level(&GPIO, SLOW_PWM, 0);
+            esp_rom_gpio_connect_out_signal(SLOW_PWM, SIG_GPIO_OUT_IDX, false, false);
+            g_trig_armed = false;
+        }
+        g_trig_measure = false;
+        gpio_ll_intr_disable(&GPIO, SLOW_PWM);
+        g_rmt_streaming = false; // очередь опустеет штатно, это не разрыв
+        xTaskNotifyFromISR(g_rmt_task, RMT_NOTIFY_TRIG_STOP, eSetBits, &high_task_wakeup);
+    }
+    if (high_task_wakeup == pdTRUE) portYIELD_FROM_ISR();
+}
+
+// Первый фронт на выходе после запуска: измерение задержки запуск -> первый фронт.
+// Вход SLOW_PWM включен через io_loop_back канала RMT, поэтому фронт виден как вход GPIO.
+// Прерывание разрешается фронтом запуска и запрещается здесь же после первого фронта,
+// иначе каждый зуб выходного сигнала вызывал бы прерывание.
+static void IRAM_ATTR trig_output_edge_isr(void *arg)
+{
+    gpio_ll_intr_disable(&GPIO, SLOW_PWM);
+    if (!g_trig_measure) return;
+    g_trig_measure = false;
+
+    uint32_t lat = (uint32_t)(esp_timer_get_time() - g_trig_edge_us);
+    g_trig_lat_last_us = lat;
+    if (g_trig_count == 0 || lat < g_trig_lat_min_us) g_trig_lat_min_us = lat;
+    if (lat > g_trig_lat_max_us) g_trig_lat_max_us = lat;
+    g_trig_count++;
+}
+
+// Настройка входа внешнего запуска и измерителя задержки (однократно)
+static void trig_init(void)
+{
+    gpio_config_t io = {
+        .pin_bit_mask = 1ULL << TRIG_IN,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_ENABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+    gpio_config(&io);
+
+    esp_err_t rc = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (rc != ESP_OK && rc != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "TRIG: isr service install failed (%d)", rc);
+        return;
+    }
+    g_trig_isr_core = xPortGetCoreID();
+    gpio_isr_handler_add(TRIG_IN, trig_isr, NULL);
+    gpio_set_intr_type(SLOW_PWM, GPIO_INTR_POSEDGE);
+    gpio_isr_handler_add(SLOW_PWM, trig_output_edge_isr, NULL);
+    gpio_intr_disable(SLOW_PWM); // включается только на время измерения задержки
+}
+
+// Остановка передачи, удаление канала и перевод GPIO в низкий уровень.
+// flush=false — немедленный останов без ожидания передачи поставленных кадров.
+static void rmt_teardown_channel(bool flush)
+{
+    g_trig_armed = false;
+    if (!g_rmt_channel) return;
+    g_rmt_streaming = false;
+
+    // Попытка кратковременного сброса очереди, затем отключение канала
+    if (flush) rmt_tx_wait_all_done(g_rmt_channel, pdMS_TO_TICKS(50));
+
+    // Отключение и удаление канала для полного освобождения управления GPIO
+    rmt_disable(g_rmt_channel);
+    rmt_del_channel(g_rmt_channel);
+    g_rmt_channel = NULL;
+    g_rmt_channel_res_hz = 0;
+    g_rmt_inflight = 0;
+    if (g_rmt_copy_encoder) {
+        rmt_del_encoder(g_rmt_copy_encoder);
+        g_rmt_copy_encoder = NULL;
+    }
+
+    // Принудительная установка GPIO в низкий уровень для предотвращения плавающего состояния/глюков во время перенастройки
+    gpio_set_level(SLOW_PWM, 0);
+    gpio_set_direction(SLOW_PWM, GPIO_MODE_OUTPUT);
+}
+
+// Ожидание события для задачи RMT: завершение транзакций, перенастройка или внешний запуск.
+// Биты запуска/останова, не относящиеся к текущему режиму, игнорируются.
+static rmt_event_t rmt_wait_event(uint32_t *out_completed)
 {
-    // RMT уже настроен/установлен в init_pwm_from_globals
     while (1) {
-        if (!g_use_rmt) {
-            vTaskDelay(pdMS_TO_TICKS(100));
+        uint32_t notif_val = 0;
+        // Ожидание либо завершения передачи (notify give увеличивает счетчик), либо обновления конфигурации (установлен старший бит)
+        xTaskNotifyWait(0, 0xFFFFFFFF, &notif_val, portMAX_DELAY);
+
+        // Если установлен бит изменения конфигурации, прерываем для пересборки с новыми параметрами
+        if (notif_val & RMT_NOTIFY_RECONFIG) return RMT_EVT_RECONFIG;
+
+        int mode = g_params.trig_mode;
+        if ((notif_val & RMT_NOTIFY_TRIG_STOP) && mode == TRIG_MODE_GATE) return RMT_EVT_STOP;
+        if ((notif_val & RMT_NOTIFY_TRIG_START) && mode == TRIG_MODE_RESYNC) return RMT_EVT_RESYNC;
+
+        // младшие биты содержат количество завершенных транзакций
+        uint32_t completed = notif_val & RMT_NOTIFY_DONE_MASK;
+        if (completed) {
+            *out_completed = completed;
+            return RMT_EVT_DONE;
+        }
+    }
+}
+
+// Режим GATE: канал создан и кадр готов, ожидаем разрешающий фронт.
+// Возвращает false, если вместо запуска пришел запрос перенастройки.
+// Пока g_trig_armed не взведен, задний фронт не отключает выход от RMT, поэтому
+// выход из ожидания любым путем оставляет канал подключенным к SLOW_PWM.
+static bool rmt_wait_trigger_start(void)
+{
+    g_trig_armed = false;
+    // фронты, пришедшие до этого момента (например, во время паузы перестройки), устарели:
+    // уровень входа ниже читается уже после сброса
+    ulTaskNotifyValueClear(NULL, RMT_NOTIFY_TRIG_START | RMT_NOTIFY_TRIG_STOP);
+    if (g_params.trig_mode != TRIG_MODE_GATE || gpio_get_level(TRIG_IN)) {
+        g_trig_armed = true;
+        return true;
+    }
+
+    while (1) {
+        uint32_t notif_val = 0;
+        xTaskNotifyWait(0, 0xFFFFFFFF, &notif_val, portMAX_DELAY);
+        if (notif_val & RMT_NOTIFY_RECONFIG) return false;
+        // Импульс короче времени пробуждения задачи (оба фронта сразу) пропускаем
+        if (g_params.trig_mode != TRIG_MODE_GATE ||
+            ((notif_val & RMT_NOTIFY_TRIG_START) && !(notif_val & RMT_NOTIFY_TRIG_STOP))) {
+            g_trig_armed = true;
+            return true;
+        }
+    }
+}
+
+// Постановка транзакции с учетом числа транзакций в полете. Счетчик увеличивается
+// до rmt_transmit: короткая транзакция может завершиться раньше возврата из вызова.
+static esp_err_t rmt_submit(const rmt_symbol_word_t *items, uint32_t count, const rmt_transmit_config_t *cfg)
+{
+    portENTER_CRITICAL(&g_rmt_mux);
+    g_rmt_inflight++;
+    portEXIT_CRITICAL(&g_rmt_mux);
+    esp_err_t err = rmt_transmit(g_rmt_channel, g_rmt_copy_encoder, items, count * sizeof(rmt_symbol_word_t), cfg);
+    if (err != ESP_OK) {
+        portENTER_CRITICAL(&g_rmt_mux);
+        if (g_rmt_inflight > 0) g_rmt_inflight--;
+        portEXIT_CRITICAL(&g_rmt_mux);
+    }
+    return err;
+}
+
+// Перезапуск канала с пустой очередью (отключение сбрасывает поставленные транзакции без callback)
+static void rmt_restart_channel(void)
+{
+    g_rmt_streaming = false;
+    rmt_disable(g_rmt_channel);
+    g_rmt_inflight = 0;
+    rmt_enable(g_rmt_channel);
+}
+
+// Учет задержки пополнения (от завершения транзакции до пробуждения задачи) и
+// опустошений очереди. Каждое опустошение добавляет одну транзакцию к целевой глубине,
+// после RMT_UNDERRUN_DECAY_MS без опустошений добавка снимается по одной.
+// sample=true только для пробуждения по завершению транзакции: при других пробуждениях
+// (перенастройка, запуск) время с последнего завершения — не задержка пополнения.
+// Возвращает число транзакций, которое нужно держать в очереди при длительности транзакции txn_us.
+static uint32_t rmt_queue_update(uint32_t txn_us, bool sample, uint32_t *seen_underruns, int64_t *slack_since_us)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t lat = g_rmt_refill_lat_us;
+    uint32_t peak = g_rmt_refill_peak_us;
+    if (sample) {
+        lat = (uint32_t)now - g_rmt_done_us;
+        peak = (lat > peak - peak / 64) ? lat : peak - peak / 64;
+        g_rmt_refill_lat_us = lat;
+        g_rmt_refill_peak_us = peak;
+    }
+
+    uint32_t underruns = g_rmt_underruns;
+    if (underruns != *seen_underruns) {
+        if (g_rmt_underrun_slack < RMT_TX_QUEUE_DEPTH) g_rmt_underrun_slack++;
+        *slack_since_us = now;
+        *seen_underruns = underruns;
+        ESP_LOGW(TAG, "RMT: queue underrun #%u (refill latency %u us, peak %u us), slack %u",
+                 (unsigned)underruns, (unsigned)lat, (unsigned)peak, (unsigned)g_rmt_underrun_slack);
+    } else if (g_rmt_underrun_slack > 0 && now - *slack_since_us >= (int64_t)RMT_UNDERRUN_DECAY_MS * 1000) {
+        g_rmt_underrun_slack--;
+        *slack_since_us = now;
+    }
+
+    // пока задача не проснулась, выход питают уже поставленные транзакции
+    uint32_t cover = peak + RMT_REFILL_MARGIN_US;
+
+    // минимальная длина кадра: покрытие задержки — не больше половины очереди канала,
+    // вторая половина остается под добавки после опустошений; шаг 1 мс, чтобы кадр
+    // не пересобирался при каждом изменении пика
+    uint32_t frame_min = (cover / (RMT_TX_QUEUE_DEPTH / 2) + 999U) / 1000U * 1000U;
+    if (frame_min < RMT_FRAME_MIN_US) frame_min = RMT_FRAME_MIN_US;
+    if (frame_min > RMT_FRAME_MAX_MIN_US) frame_min = RMT_FRAME_MAX_MIN_US;
+    g_rmt_frame_min_us = frame_min;
+
+    uint32_t target = (txn_us > 0) ? (cover + txn_us - 1) / txn_us + 1 : RMT_TX_QUEUE_DEPTH;
+    target += g_rmt_underrun_slack;
+    if (target < RMT_TX_MIN_QUEUED) target = RMT_TX_MIN_QUEUED;
+    if (target > RMT_TX_QUEUE_DEPTH) target = RMT_TX_QUEUE_DEPTH;
+    if (target != g_rmt_queue_target) {
+        ESP_LOGI(TAG, "RMT: queue target %u -> %u (txn %u us)", (unsigned)g_rmt_queue_target, (unsigned)target, (unsigned)txn_us);
+        g_rmt_queue_target = target;
+        g_rmt_queue_adjusts++;
+    }
+    return target;
+}
+
+static int rmt_queue_frame(const rmt_symbol_word_t *items, uint32_t idx, int count, const rmt_transmit_config_t *cfg)
+{
+    int queued = 0;
+    for (int q = 0; q < count; ++q) {
+        esp_err_t terr = rmt_submit(items, idx, cfg);
+        if (terr != ESP_OK) {
+            ESP_LOGW(TAG, "RMT: initial transmit queue failed at slot %d (%d)", q, terr);
+            break;
+        }
+        queued++;
+    }
+    return queued;
+}
+
+// Снимок параметров генератора и публикация версии, которую он содержит.
+// seq_prog (может быть NULL) получает копию программы секвенсора.
+static void rmt_take_snapshot(rmt_snapshot_t *snap, seq_insn_t *seq_prog)
+{
+    memset(snap, 0, sizeof(*snap));
+    snap->key.pattern = FRAME_PATTERN_UNIFORM;
+    snap->follow_cfg = (follow_cfg_t){ .in_teeth = 1, .mul = 1, .div = 1 };
+    snap->enc_cfg = (enc_cfg_t){ .lines = ENC_DEFAULT_LINES, .dir = 0 };
+
+    if (g_param_lock && xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(50)) == pdTRUE) {
+        snap->enabled = g_params.enabled;
+        snap->key.pulses = g_params.pulses_per_rev;
+        snap->key.rpm_milli = g_params.rpm_milli;
+        snap->key.pulse_pct = g_params.pulse_pct;
+        snap->trig_mode = g_params.trig_mode;
+        snap->follow = g_params.follow;
+        snap->follow_cfg = g_params.follow_cfg;
+        snap->enc = g_params.enc;
+        snap->enc_cfg = g_params.enc_cfg;
+        snap->seq_len = g_params.seq_len;
+        if (seq_prog && snap->seq_len > 0) memcpy(seq_prog, g_params.seq_prog, snap->seq_len * sizeof(seq_insn_t));
+        g_cfg_applied = g_params.version;
+        xSemaphoreGive(g_param_lock);
+    } else {
+        snap->enabled = g_output_enabled;
+        snap->key.pulses = g_pulses_per_rev;
+        if (snap->key.pulses < 1) snap->key.pulses = 1;
+        snap->key.rpm_milli = g_rpm_milli;
+        snap->key.pulse_pct = g_pulse_percent;
+    }
+}
+
+// Параметры передаваемого кадра для /status
+static void frame_report(const frame_cache_entry_t *frame)
+{
+    g_frame_res_hz = frame->plan.res_hz;
+    g_frame_symbols = frame->count;
+    g_frame_err_ppb = frame->plan.err_ppb;
+    g_frame_truncated = frame->truncated;
+    g_frame_reps = frame->plan.reps;
+}
+
+// Перенастройка без пересоздания канала: новая конфигурация — равномерный кадр, который уже
+// есть в кэше (например, закрепленный пресет) и собран под текущий тик канала. Возвращает
+// кадр для постановки в очередь или NULL, если нужна полная перестройка.
+static frame_cache_entry_t *rmt_frame_hot_swap(void)
+{
+    rmt_snapshot_t snap;
+    rmt_take_snapshot(&snap, NULL);
+    if (!snap.enabled || snap.follow || snap.enc || snap.seq_len > 0) return NULL;
+    // вход запуска включается вместе с io_loop_back при создании канала
+    if ((snap.trig_mode != TRIG_MODE_OFF) != g_rmt_channel_loopback) return NULL;
+    return frame_cache_swap(&snap.key, g_rmt_channel_res_hz);
+}
+
+// Передача кадра полного оборота по кругу до запроса перенастройки или внешнего останова.
+// Кадр берется из кэша; при промахе собирается и остается в кэше для повторного использования.
+// Перенастройка на кадр из кэша с тем же тиком выполняется на ходу: новый кадр ставится
+// в очередь за уже поставленными, без пересоздания канала и паузы перестройки. Прежние
+// кадры уходят из очереди по порядку (до FRAME_DRAIN_MAX сразу); при заполненном FIFO
+// замена откладывается до ухода самого старого. Так же на ходу кадр удлиняется, когда
+// задержка пополнения выросла (g_rmt_frame_min_us).
+static rmt_run_result_t rmt_run_frame(const frame_key_t *key)
+{
+    frame_cache_entry_t *frame = frame_cache_acquire(key);
+    if (!frame) {
+        vTaskDelay(pdMS_TO_TICKS(500));
+        return RMT_RUN_FAILED;
+    }
+    frame_report(frame);
+
+    // Использование неблокирующей очереди передач и поддержание небольшого окна пополнения.
+    rmt_transmit_config_t transmit_cfg_nonblocking = {
+        .loop_count = 0,
+        .flags = { .eot_level = 0, .queue_nonblocking = 0 }
+    };
+
+    // Регистрация callback-функции завершения передачи для уведомления об окончании транзакции
+    rmt_tx_event_callbacks_t tx_cbs = {
+        .on_trans_done = rmt_tx_done_cb,
+    };
+    rmt_tx_register_event_callbacks(g_rmt_channel, &tx_cbs, NULL);
+
+    uint32_t seen_underruns = g_rmt_underruns;
+    int64_t slack_since_us = esp_timer_get_time();
+    int initial_queue = (int)rmt_queue_update(frame->plan.frame_us, false, &seen_underruns, &slack_since_us);
+
+    // Кадр собран заранее: в режиме GATE запуск по фронту сводится к постановке в очередь
+    if (!rmt_wait_trigger_start()) {
+        rmt_teardown_channel(false);
+        frame_cache_release(false);
+        return RMT_RUN_RECONFIG;
+    }
+
+    if (rmt_queue_frame(frame->items, frame->count, initial_queue, &transmit_cfg_nonblocking) == 0) {
+        frame_cache_release(false);
+        vTaskDelay(pdMS_TO_TICKS(100));
+        return RMT_RUN_FAILED;
+    }
+    frame_publish(frame);
+    g_rmt_streaming = true;
+
+    // Прежние кадры после замен (FIFO, как g_frame_cache_draining): значение
+    // g_rmt_done_total, после которого последняя транзакция кадра ушла из очереди
+    uint32_t drain_mark[FRAME_DRAIN_MAX];
+    uint32_t drain_n = 0;
+    bool swap_pending = false; // перенастройка ждет места в FIFO прежних кадров
+    uint32_t regrow_checked_us = 0; // минимальная длина, под которую уже пробовали удлинить кадр
+
+    // Цикл пополнения: ожидание уведомлений от callback-функции завершения или бита изменения конфигурации
+    rmt_run_result_t result = RMT_RUN_RECONFIG;
+    while (1) {
+        uint32_t completed = 0;
+        frame_cache_entry_t *next = NULL;
+        rmt_event_t evt = rmt_wait_event(&completed);
+        if (evt == RMT_EVT_RECONFIG) {
+            swap_pending = true;
+        } else if (evt == RMT_EVT_STOP) {
+            result = RMT_RUN_STOPPED;
+            break;
+        } else if (evt == RMT_EVT_RESYNC) {
+            // отключение канала прерывает текущую и поставленные транзакции; кадр начинается заново
+            rmt_restart_channel();
+            if (drain_n > 0) {
+                frame_cache_release(true);
+                drain_n = 0;
+            }
+            rmt_queue_frame(frame->items, frame->count, (int)g_rmt_queue_target, &transmit_cfg_nonblocking);
+            g_rmt_streaming = true;
             continue;
         }
 
-        // Проверка статуса включения из снимка или глобальной переменной
-        bool enabled_local = true;
-        if (g_param_lock && xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(50)) == pdTRUE) {
-            enabled_local = g_params.enabled;
-            xSemaphoreGive(g_param_lock);
-        } else {
-            enabled_local = g_output_enabled;
+        // транзакции завершаются по порядку: прежние кадры уходят из FIFO с головы
+        uint32_t done_total = g_rmt_done_total;
+        uint32_t drained = 0;
+        while (drained < drain_n && (int32_t)(done_total - drain_mark[drained]) >= 0) drained++;
+        if (drained > 0) {
+            frame_cache_release_drained(drained);
+            drain_n -= drained;
+            memmove(&drain_mark[0], &drain_mark[drained], drain_n * sizeof(drain_mark[0]));
         }
 
-        if (!enabled_local) {
-            // Если отключено, убеждаемся, что канал остановлен и GPIO в низком уровне
-            if (g_rmt_channel) {
-                rmt_tx_wait_all_done(g_rmt_channel, pdMS_TO_TICKS(50));
-                rmt_disable(g_rmt_channel);
-                rmt_del_channel(g_rmt_channel);
-                g_rmt_channel = NULL;
-                if (g_rmt_copy_encoder) {
-                    rmt_del_encoder(g_rmt_copy_encoder);
-                    g_rmt_copy_encoder = NULL;
+        // Замена, для которой не хватило места в FIFO, выполняется после ухода самого старого кадра
+        if (swap_pending && drain_n < FRAME_DRAIN_MAX) {
+            swap_pending = false;
+            next = rmt_frame_hot_swap();
+            if (!next) break;
+            if (next == frame) next = NULL;
+        }
+
+        // задержка пополнения выросла: кадр удлиняется, чтобы очередь не упиралась в глубину канала
+        uint32_t frame_min_us = g_rmt_frame_min_us;
+        if (!next && !swap_pending && drain_n == 0 && frame->plan.frame_us < frame_min_us && frame_min_us != regrow_checked_us) {
+            regrow_checked_us = frame_min_us;
+            rmt_frame_plan_t plan;
+            if (rmt_plan_frame(&frame->key, &plan) && plan.frame_us > frame->plan.frame_us) {
+                next = frame_cache_regrow(frame);
+                if (next) {
+                    ESP_LOGI(TAG, "RMT: frame %u -> %u us for refill latency %u us",
+                             (unsigned)frame->plan.frame_us, (unsigned)next->plan.frame_us, (unsigned)g_rmt_refill_peak_us);
                 }
-                gpio_set_level(SLOW_PWM, 0);
-                gpio_set_direction(SLOW_PWM, GPIO_MODE_OUTPUT);
             }
-            // Ожидание уведомления об изменении конфигурации
-            uint32_t notif_val = 0;
-            xTaskNotifyWait(0, 0xFFFFFFFF, &notif_val, pdMS_TO_TICKS(500));
-            continue;
         }
 
-        // Убеждаемся, что канал существует (на случай, если он был удален при перенастройке)
-        if (!g_rmt_channel) {
-            init_pwm_from_globals();
-            if (!g_rmt_channel) {
-                vTaskDelay(pdMS_TO_TICKS(100));
-                continue;
+        if (next) {
+            // Публикация переходит на новый кадр до снятия защиты с прежнего: опубликованный
+            // кадр всегда active или draining, иначе /frame мог бы отдавать освобожденный буфер
+            frame = next;
+            frame_report(frame);
+            frame_publish(frame);
+            // новый кадр встает в очередь за транзакциями прежнего
+            // (пустая очередь дает метку, уже пройденную: кадр снимается при следующем пробуждении)
+            portENTER_CRITICAL(&g_rmt_mux);
+            drain_mark[drain_n++] = g_rmt_done_total + g_rmt_inflight;
+            portEXIT_CRITICAL(&g_rmt_mux);
+        }
+
+        // очередь доводится до целевой глубины; после опустошения — сразу с запасом
+        uint32_t target = rmt_queue_update(frame->plan.frame_us, evt == RMT_EVT_DONE, &seen_underruns, &slack_since_us);
+        while (g_rmt_inflight < target) {
+            if (rmt_submit(frame->items, frame->count, &transmit_cfg_nonblocking) != ESP_OK) {
+                // при ошибке прерываем; следующий callback уведомит снова
+                break;
             }
         }
+    }
 
-        // Канал может быть отключен после обновления конфигурации; убеждаемся, что TX включен.
-        esp_err_t en_err = rmt_enable(g_rmt_channel);
-        if (en_err != ESP_OK && en_err != ESP_ERR_INVALID_STATE) {
-            ESP_LOGE(TAG, "RMT: enable failed (%d)", en_err);
-            vTaskDelay(pdMS_TO_TICKS(100));
-            continue;
+    g_rmt_streaming = false;
+    frame_publish(NULL);
+    rmt_teardown_channel(result == RMT_RUN_RECONFIG);
+    frame_cache_release(false);
+    return result;
+}
+
+// Заполнение кольца буферов секвенсора с начала; возвращает число поставленных транзакций.
+// Заполнение прекращается на блоке, в котором программа закончилась.
+static int rmt_seq_prime(seq_vm_t *vm, rmt_symbol_word_t bufs[][SEQ_CHUNK_SYMBOLS], int ring, const rmt_transmit_config_t *cfg)
+{
+    int queued = 0;
+    for (int b = 0; b < ring && vm->end == SEQ_END_NONE; ++b) {
+        uint32_t n = seq_vm_fill(vm, &bufs[b][0].val, SEQ_CHUNK_SYMBOLS);
+        if (n == 0 || rmt_submit(bufs[b], n, cfg) != ESP_OK) {
+            break;
         }
+        queued++;
+    }
+    return queued;
+}
 
-        // Атомарное копирование параметров в локальные переменные
-        int pulses;
-        uint32_t pulse_us;
-        uint32_t pause_us;
-
-        if (g_param_lock && xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(50)) == pdTRUE) {
-            pulses = g_params.pulses_per_rev;
-            pulse_us = g_params.pulse_us;
-            pause_us = g_params.pause_us;
-            xSemaphoreGive(g_param_lock);
-        } else {
-            pulses = g_pulses_per_rev;
-            if (pulses < 1) pulses = 1;
-            pulse_us = g_pulse_us;
-            pause_us = g_pause_us;
-            (void)g_pulse_percent;
-            (void)g_rpm;
-        }
-
-        // вычисление количества фрагментов для импульса (каждый фрагмент <= RMT_MAX_DURATION тиков)
-        uint32_t chunks_per_pulse = (pulse_us + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION;
-        if (chunks_per_pulse == 0) chunks_per_pulse = 1;
-
-        // общее количество сегментов на один оборот (высокие + низкие фрагменты на импульс)
-        // каждый символ RMT содержит до двух сегментов (duration0 + duration1)
-        uint32_t chunks_per_pause = (pause_us + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION;
-        if (chunks_per_pause == 0) chunks_per_pause = 1;
-
-        uint32_t total_segments = (uint32_t)pulses * (chunks_per_pulse + chunks_per_pause);
-        uint32_t total_items = (total_segments + 1) / 2;
-        if (total_items > RMT_MAX_ITEMS_CAP) {
-            ESP_LOGW(TAG, "RMT: requested %u items exceeds cap %u, clamping", total_items, RMT_MAX_ITEMS_CAP);
-            total_items = RMT_MAX_ITEMS_CAP;
-        }
-
-        size_t alloc_size = total_items * sizeof(rmt_symbol_word_t);
-        rmt_symbol_word_t *items = (rmt_symbol_word_t *)malloc(alloc_size);
-        if (!items) {
-            ESP_LOGE(TAG, "RMT: malloc failed for %u items", (unsigned)total_items);
-            vTaskDelay(pdMS_TO_TICKS(500));
+// Передача потока, генерируемого секвенсором. Блоки символов образуют кольцо из
+// буферов (не больше SEQ_RING_MAX): транзакции завершаются по порядку, поэтому по каждому
+// уведомлению освобождается самый старый буфер, который заполняется заново.
+// Размер кольца берется из целевой глубины очереди и на время прогона не меняется.
+// Когда программа заканчивается (HALT или шаги без вывода), оставшиеся в очереди блоки передаются,
+// выход остается в низком уровне (eot_level), причина публикуется в g_seq_end; задача ждет
+// RESYNC (перезапуск программы), останова или перенастройки.
+static rmt_run_result_t rmt_run_sequencer(const seq_insn_t *prog, uint16_t len)
+{
+    static rmt_symbol_word_t bufs[SEQ_RING_MAX][SEQ_CHUNK_SYMBOLS];
+    static seq_vm_t vm;
+
+    seq_vm_reset(&vm, prog, len);
+    g_seq_end = SEQ_END_NONE;
+    g_frame_res_hz = RMT_DEFAULT_RESOLUTION_HZ;
+    g_frame_symbols = SEQ_CHUNK_SYMBOLS;
+    g_frame_err_ppb = 0;
+    g_frame_truncated = false;
+    g_frame_reps = 1;
+
+    rmt_transmit_config_t transmit_cfg = {
+        .loop_count = 0,
+        .flags = { .eot_level = 0, .queue_nonblocking = 0 }
+    };
+    rmt_tx_event_callbacks_t tx_cbs = {
+        .on_trans_done = rmt_tx_done_cb,
+    };
+    rmt_tx_register_event_callbacks(g_rmt_channel, &tx_cbs, NULL);
+
+    int ring = (int)g_rmt_queue_target;
+    if (ring > SEQ_RING_MAX) ring = SEQ_RING_MAX;
+    uint32_t seen_underruns = g_rmt_underruns;
+    int64_t slack_since_us = esp_timer_get_time();
+    uint32_t chunk_us = 0; // средняя длительность блока по интервалам между завершениями
+
+    if (!rmt_wait_trigger_start()) {
+        rmt_teardown_channel(false);
+        return RMT_RUN_RECONFIG;
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    int queued = rmt_seq_prime(&vm, bufs, ring, &transmit_cfg);
+    int64_t fill_us = esp_timer_get_time() - t0;
+    uint64_t fill_symbols = (uint64_t)queued * SEQ_CHUNK_SYMBOLS;
+    if (queued == 0 && vm.end == SEQ_END_NONE) {
+        ESP_LOGW(TAG, "SEQ: failed to queue program output");
+        vTaskDelay(pdMS_TO_TICKS(100));
+        return RMT_RUN_FAILED;
+    }
+    // закончившаяся программа опустошает очередь штатно, это не разрыв
+    g_rmt_streaming = (vm.end == SEQ_END_NONE);
+    int64_t last_done = esp_timer_get_time();
+
+    int head = 0;
+    rmt_run_result_t result = RMT_RUN_RECONFIG;
+    while (1) {
+        if (vm.end != SEQ_END_NONE && g_seq_end == SEQ_END_NONE && g_rmt_inflight == 0) {
+            // последний блок передан, линия осталась в низком уровне
+            g_seq_end = vm.end;
+            ESP_LOGI(TAG, "SEQ: program %s at rev %u, output idle low",
+                     vm.end == SEQ_END_HALT ? "halted" : "stalled", (unsigned)vm.rev);
+        }
+
+        uint32_t completed = 0;
+        rmt_event_t evt = rmt_wait_event(&completed);
+        if (evt == RMT_EVT_RECONFIG) break;
+        if (evt == RMT_EVT_STOP) {
+            result = RMT_RUN_STOPPED;
+            break;
+        }
+        if (evt == RMT_EVT_RESYNC) {
+            // программа перезапускается с первой инструкции и нулевого оборота
+            rmt_restart_channel();
+            seq_vm_reset(&vm, prog, len);
+            g_seq_end = SEQ_END_NONE;
+            rmt_seq_prime(&vm, bufs, ring, &transmit_cfg);
+            head = 0;
+            g_rmt_streaming = (vm.end == SEQ_END_NONE);
             continue;
         }
+        if (vm.end != SEQ_END_NONE) continue; // программа закончилась, ждем опустошения очереди
+
+        // длительность блока секвенсора заранее неизвестна и оценивается по ходу;
+        // кольцо на время прогона фиксировано, целевая глубина определяет кольцо следующего
+        int64_t now = esp_timer_get_time();
+        uint32_t interval = (uint32_t)((now - last_done) / completed);
+        last_done = now;
+        chunk_us = chunk_us ? chunk_us - chunk_us / 8 + interval / 8 : interval;
+        rmt_queue_update(chunk_us, true, &seen_underruns, &slack_since_us);
+
+        for (uint32_t c = 0; c < completed && vm.end == SEQ_END_NONE; ++c) {
+            int64_t t1 = esp_timer_get_time();
+            uint32_t n = seq_vm_fill(&vm, &bufs[head][0].val, SEQ_CHUNK_SYMBOLS);
+            fill_us += esp_timer_get_time() - t1;
+            fill_symbols += n;
+            // последний блок закончившейся программы опустошает очередь штатно, это не разрыв
+            if (vm.end != SEQ_END_NONE) g_rmt_streaming = false;
+            if (n == 0) break; // программа закончилась ровно на границе блока
+            if (rmt_submit(bufs[head], n, &transmit_cfg) != ESP_OK) {
+                // буфер не поставлен в очередь и остается свободным; следующий callback уведомит снова
+                ESP_LOGW(TAG, "SEQ: refill failed, chunk dropped");
+                break;
+            }
+            head = (head + 1) % ring;
+        }
 
-        // Построение потока символов полного оборота (высокий+низкий для каждого импульса).
-        // Важно: не вставлять duration1=0 внутрь потока, иначе RMT
-        // воспримет это как маркер остановки и преждевременно обрежет сигнал.
-        rmt_symbol_builder_t builder = {
-            .items = items,
-            .cap = total_items,
-            .idx = 0,
-            .half_filled = false,
-        };
-        bool truncated = false;
-        for (int p = 0; p < pulses; ++p) {
-            if (!rmt_builder_append_segment(&builder, 1, pulse_us) ||
-                !rmt_builder_append_segment(&builder, 0, pause_us)) {
-                truncated = true;
+        // Пропускная способность интерпретатора (символов/с), усредненная с момента запуска
+        if (fill_us > 0) {
+            g_seq_symbols_per_sec = (uint32_t)((fill_symbols * 1000000ULL) / (uint64_t)fill_us);
+        }
+    }
+
+    g_rmt_streaming = false;
+    g_seq_end = SEQ_END_NONE;
+    rmt_teardown_channel(result == RMT_RUN_RECONFIG);
+    return result;
+}
+
+// Захват входного сигнала (MCPWM capture): период между передними фронтами в тиках таймера захвата
+static bool IRAM_ATTR cap_edge_cb(mcpwm_cap_channel_handle_t cap_chan, const mcpwm_capture_event_data_t *edata, void *user_ctx)
+{
+    uint32_t now_us = (uint32_t)esp_timer_get_time();
+    // после долгого отсутствия сигнала первый фронт только начинает новое измерение
+    if ((now_us - g_cap_last_edge_us) > FOLLOW_MAX_IN_PERIOD_US) g_cap_valid_edges = 0;
+    if (g_cap_valid_edges > 0) {
+        // беззнаковая разность корректна при одном переполнении 32-битного счетчика
+        g_cap_period_ticks = edata->cap_value - g_cap_last_value;
+    }
+    g_cap_last_value = edata->cap_value;
+    g_cap_last_edge_us = now_us;
+    if (g_cap_valid_edges < 2) g_cap_valid_edges++;
+
+    BaseType_t high_task_wakeup = pdFALSE;
+    if (g_params.follow && g_rmt_task) {
+        xTaskNotifyFromISR(g_rmt_task, RMT_NOTIFY_CAPTURE, eSetBits, &high_task_wakeup);
+    }
+    return high_task_wakeup == pdTRUE;
+}
+
+// Настройка захвата входного сигнала CAP_IN (однократно)
+static void cap_init(void)
+{
+    mcpwm_cap_timer_handle_t cap_timer = NULL;
+    mcpwm_capture_timer_config_t timer_cfg = {
+        .group_id = 0,
+        .clk_src = MCPWM_CAPTURE_CLK_SRC_DEFAULT,
+    };
+    if (mcpwm_new_capture_timer(&timer_cfg, &cap_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "CAP: new capture timer failed");
+        return;
+    }
+
+    mcpwm_cap_channel_handle_t cap_chan = NULL;
+    mcpwm_capture_channel_config_t chan_cfg = {
+        .gpio_num = CAP_IN,
+        .prescale = 1,
+        .flags = { .pos_edge = 1, .neg_edge = 0, .pull_up = 0, .pull_down = 1 },
+    };
+    if (mcpwm_new_capture_channel(cap_timer, &chan_cfg, &cap_chan) != ESP_OK) {
+        ESP_LOGE(TAG, "CAP: new capture channel failed");
+        return;
+    }
+
+    mcpwm_capture_event_callbacks_t cbs = {
+        .on_cap = cap_edge_cb,
+    };
+    mcpwm_capture_channel_register_event_callbacks(cap_chan, &cbs, NULL);
+    mcpwm_capture_channel_enable(cap_chan);
+    mcpwm_capture_timer_enable(cap_timer);
+    uint32_t res = 0;
+    mcpwm_capture_timer_get_resolution(cap_timer, &res);
+    g_cap_resolution_hz = res;
+    mcpwm_capture_timer_start(cap_timer);
+}
+
+// Частота входного сигнала в мГц (0 — сигнал отсутствует или еще не измерен)
+static uint32_t cap_input_freq_mhz(void)
+{
+    uint32_t ticks = g_cap_period_ticks;
+    uint32_t res = g_cap_resolution_hz;
+    if (g_cap_valid_edges < 2 || ticks == 0 || res == 0) return 0;
+
+    uint32_t age_us = (uint32_t)esp_timer_get_time() - g_cap_last_edge_us;
+    uint64_t period_us = ((uint64_t)ticks * 1000000ULL) / res;
+    uint64_t timeout_us = period_us * FOLLOW_LOSS_PERIODS;
+    if (timeout_us < FOLLOW_LOSS_MIN_US) timeout_us = FOLLOW_LOSS_MIN_US;
+    if (age_us > timeout_us) return 0;
+
+    return (uint32_t)(((uint64_t)res * 1000ULL + ticks / 2) / ticks);
+}
+
+// Длительности выходного зуба по последнему измеренному периоду входа:
+// период оборота = период входа * in_teeth, масштаб mul/div, на выходе out_pulses зубьев.
+// Доля микросекунды, не вошедшая в зуб, переносится в следующий через carry_ns,
+// поэтому средний период выхода не смещается округлением до тика.
+static bool follow_compute_tooth(const follow_cfg_t *cfg, int out_pulses, int pulse_pct, uint32_t *carry_ns, uint32_t *out_pulse_us, uint32_t *out_pause_us)
+{
+    if (cap_input_freq_mhz() == 0) {
+        *carry_ns = 0;
+        return false;
+    }
+
+    uint32_t ticks = g_cap_period_ticks;
+    uint64_t in_period_ns = ((uint64_t)ticks * 1000000000ULL) / g_cap_resolution_hz;
+    uint64_t num = in_period_ns * (uint64_t)cfg->in_teeth * (uint64_t)cfg->div;
+    uint64_t den = (uint64_t)out_pulses * (uint64_t)cfg->mul;
+    uint64_t total_ns = num / den + *carry_ns;
+    uint64_t total = total_ns / 1000ULL;
+    *carry_ns = (uint32_t)(total_ns % 1000ULL);
+    if (total < FOLLOW_MIN_PERIOD_US || total > FOLLOW_MAX_PERIOD_US) {
+        total = (total < FOLLOW_MIN_PERIOD_US) ? FOLLOW_MIN_PERIOD_US : FOLLOW_MAX_PERIOD_US;
+        *carry_ns = 0;
+    }
+
+    uint32_t pulse_us = (uint32_t)((total * (uint64_t)pulse_pct + 50U) / 100U);
+    if (pulse_us < 1) pulse_us = 1;
+    if (pulse_us >= total) pulse_us = (uint32_t)total - 1;
+
+    *out_pulse_us = pulse_us;
+    *out_pause_us = (uint32_t)total - pulse_us;
+    return true;
+}
+
+// Режим слежения: каждый выходной зуб — отдельная транзакция, в очереди FOLLOW_BUFFERS зубьев,
+// так что следующий зуб начинается встык с текущим без участия задачи. По завершении зуба
+// освободившийся буфер заполняется по последнему измерению. Новый период входа попадает на
+// выход не позднее чем через FOLLOW_BUFFERS выходных зуба (текущий и уже поставленный).
+// Выходной зуб равен периоду входа * in_teeth * div / (mul * pulses), поэтому задержка
+// укладывается в один период входа только при mul * pulses >= FOLLOW_BUFFERS * in_teeth * div;
+// при делении частоты (in_teeth > pulses и т. п.) она составляет до нескольких периодов входа.
+static rmt_run_result_t rmt_run_follow(const follow_cfg_t *cfg, int out_pulses, int pulse_pct)
+{
+    static rmt_symbol_word_t bufs[FOLLOW_BUFFERS][FOLLOW_TOOTH_SYMBOLS];
+    g_frame_res_hz = RMT_DEFAULT_RESOLUTION_HZ;
+    g_frame_symbols = 0;
+    g_frame_err_ppb = 0;
+    g_frame_truncated = false;
+    g_frame_reps = 1;
+
+    rmt_transmit_config_t transmit_cfg = {
+        .loop_count = 0,
+        .flags = { .eot_level = 0, .queue_nonblocking = 0 }
+    };
+    rmt_tx_event_callbacks_t tx_cbs = {
+        .on_trans_done = rmt_tx_done_cb,
+    };
+    rmt_tx_register_event_callbacks(g_rmt_channel, &tx_cbs, NULL);
+
+    int head = 0; // следующий свободный буфер; транзакции завершаются по порядку
+    uint32_t in_flight = 0;
+    uint32_t carry_ns = 0;
+    while (1) {
+        while (in_flight < FOLLOW_BUFFERS) {
+            uint32_t pulse_us = 0;
+            uint32_t pause_us = 0;
+            if (!follow_compute_tooth(cfg, out_pulses, pulse_pct, &carry_ns, &pulse_us, &pause_us)) {
+                // сигнал пропал: очередь опустеет штатно, это не разрыв
+                g_rmt_streaming = false;
                 break;
             }
+            rmt_symbol_builder_t builder = {
+                .items = bufs[head],
+                .cap = FOLLOW_TOOTH_SYMBOLS,
+                .idx = 0,
+                .half_filled = false,
+            };
+            rmt_builder_append_segment(&builder, 1, pulse_us);
+            rmt_builder_append_segment(&builder, 0, pause_us);
+            uint32_t idx = rmt_builder_finalize(&builder);
+            if (rmt_submit(bufs[head], idx, &transmit_cfg) != ESP_OK) break;
+            head = (head + 1) % FOLLOW_BUFFERS;
+            in_flight++;
+            if (in_flight == FOLLOW_BUFFERS) g_rmt_streaming = true;
         }
-        uint32_t idx = rmt_builder_finalize(&builder);
-        if (truncated) {
-            ESP_LOGW(TAG, "RMT: symbol buffer truncated (cap=%u)", (unsigned)total_items);
+
+        // Без входного сигнала выход остается в нуле; опрашиваем, пока не появятся фронты
+        uint32_t notif_val = 0;
+        xTaskNotifyWait(0, 0xFFFFFFFF, &notif_val, in_flight ? portMAX_DELAY : pdMS_TO_TICKS(FOLLOW_IDLE_POLL_MS));
+        if (notif_val & RMT_NOTIFY_RECONFIG) break;
+        uint32_t done = notif_val & RMT_NOTIFY_DONE_MASK;
+        in_flight = (done >= in_flight) ? 0 : in_flight - done;
+    }
+
+    g_rmt_streaming = false;
+    rmt_teardown_channel(true);
+    return RMT_RUN_RECONFIG;
+}
+
+// Выбор тика (80 МГц / делитель) с наименьшей ошибкой периода среди тех, при которых периоды
+// Z, A и B укладываются в память своих каналов; при равной ошибке — более мелкий тик.
+// Четверть штриха — целое число тиков, поэтому A, B и Z лежат на одной сетке.
+static bool enc_plan(const enc_cfg_t *cfg, uint32_t rpm_milli, enc_plan_t *plan)
+{
+    if (rpm_milli == 0 || cfg->lines < 1) return false;
+    // четверть штриха = 60 / (rpm * lines * 4) с = 60000 * res / (4 * rpm_milli * lines) тиков
+    uint64_t den = 4ULL * rpm_milli * (uint64_t)cfg->lines;
+    bool found = false;
+
+    for (uint32_t div = 1; div <= ENC_DIV_MAX; ++div) {
+        uint32_t res = ENC_SRC_CLK_HZ / div;
+        uint64_t num = 60000ULL * res;
+        uint64_t q = (num + den / 2) / den;
+        // с ростом делителя четверть только уменьшается
+        if (q < 2) break;
+        if (q > UINT32_MAX) continue;
+
+        // Z — самый длинный период: оборот целиком, до (4 * lines - 1) четвертей подряд;
+        // один символ памяти остается под маркер конца
+        uint64_t rev_tail = q * (4ULL * (uint64_t)cfg->lines - 1);
+        uint64_t halves = (q + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION +
+                          (rev_tail + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION + 2;
+        if (halves / 2 > ENC_Z_MEM_SYMBOLS - 1) continue;
+        // A и B (один штрих) в одном блоке; существенно только при единицах штрихов на оборот
+        uint64_t line_halves = 2 * ((q + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION) +
+                               (2 * q + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION + 1;
+        if (line_halves / 2 > ENC_MEM_SYMBOLS - 1) continue;
+
+        uint64_t actual = q * den;
+        uint64_t diff = (actual > num) ? actual - num : num - actual;
+        uint32_t err_ppb = (uint32_t)((diff * 1000000000ULL) / num);
+        if (!found || err_ppb < plan->err_ppb) {
+            plan->res_hz = res;
+            plan->quarter = (uint32_t)q;
+            plan->err_ppb = err_ppb;
+            found = true;
         }
+        if (err_ppb == 0) break;
+    }
+    return found;
+}
 
-        if (idx == 0) {
-            free(items);
-            vTaskDelay(pdMS_TO_TICKS(100));
-            continue;
+// Сборка одного периода канала из сегментов. Внутри цикла нулевая длительность — маркер
+// конца, поэтому число полусимволов делается четным: при нечетном последний сегмент
+// режется на одну часть больше (каждая часть не короче тика, так как сегмент >= 2 тиков).
+static uint32_t enc_build_pattern(rmt_symbol_word_t *items, uint32_t mem_symbols, const uint32_t *levels, const uint64_t *ticks, int n)
+{
+    uint32_t halves = 0;
+    for (int i = 0; i < n; ++i) halves += (uint32_t)((ticks[i] + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION);
+
+    rmt_symbol_builder_t b = {
+        .items = items,
+        .cap = mem_symbols - 1,
+        .idx = 0,
+        .half_filled = false,
+    };
+    for (int i = 0; i < n; ++i) {
+        uint64_t left = ticks[i];
+        uint32_t pieces = (uint32_t)((left + RMT_MAX_DURATION - 1) / RMT_MAX_DURATION);
+        if (i == n - 1 && (halves & 1U)) pieces++;
+        for (; pieces > 0; --pieces) {
+            uint32_t part = (uint32_t)((left + pieces - 1) / pieces);
+            if (!rmt_builder_append_segment(&b, levels[i], part)) return 0;
+            left -= part;
         }
+    }
+    return rmt_builder_finalize(&b);
+}
+
+// Передача A/B/Z до запроса перенастройки. Символы повторяет аппаратный цикл канала,
+// задача только ждет уведомления.
+static rmt_run_result_t rmt_run_encoder(const enc_cfg_t *cfg, uint32_t rpm_milli)
+{
+    // порядок создания: Z, A, B — Z должен получить два смежных блока памяти
+    static rmt_symbol_word_t pat[3][ENC_Z_MEM_SYMBOLS];
+    const int gpios[3] = { ENC_Z, SLOW_PWM, ENC_B };
+    const uint32_t mem[3] = { ENC_Z_MEM_SYMBOLS, ENC_MEM_SYMBOLS, ENC_MEM_SYMBOLS };
+
+    enc_plan_t plan;
+    if (!enc_plan(cfg, rpm_milli, &plan)) {
+        ESP_LOGW(TAG, "ENC: %d lines at rpm=%u.%03u not representable", cfg->lines,
+                 (unsigned)(rpm_milli / 1000U), (unsigned)(rpm_milli % 1000U));
+        return RMT_RUN_FAILED;
+    }
+    g_enc_res_hz = plan.res_hz;
+    g_enc_err_ppb = plan.err_ppb;
+
+    // A: половина штриха высокий, половина низкий. B сдвинут на четверть штриха: отстает от A
+    // при dir=0 и опережает при dir=1. Z: четверть штриха там, где A и B оба высокие.
+    uint64_t q = plan.quarter;
+    uint64_t rev = q * 4ULL * (uint64_t)cfg->lines;
+    static const uint32_t a_lv[2] = { 1, 0 };
+    static const uint32_t b_fwd_lv[3] = { 0, 1, 0 };
+    static const uint32_t b_rev_lv[3] = { 1, 0, 1 };
+    static const uint32_t z_fwd_lv[3] = { 0, 1, 0 };
+    static const uint32_t z_rev_lv[2] = { 1, 0 };
+    const uint64_t a_t[2] = { 2 * q, 2 * q };
+    const uint64_t b_t[3] = { q, 2 * q, q };
+    const uint64_t z_fwd_t[3] = { q, q, rev - 2 * q };
+    const uint64_t z_rev_t[2] = { q, rev - q };
+
+    uint32_t counts[3];
+    counts[0] = cfg->dir ? enc_build_pattern(pat[0], mem[0], z_rev_lv, z_rev_t, 2)
+                         : enc_build_pattern(pat[0], mem[0], z_fwd_lv, z_fwd_t, 3);
+    counts[1] = enc_build_pattern(pat[1], mem[1], a_lv, a_t, 2);
+    counts[2] = enc_build_pattern(pat[2], mem[2], cfg->dir ? b_rev_lv : b_fwd_lv, b_t, 3);
+    if (counts[0] == 0 || counts[1] == 0 || counts[2] == 0) {
+        ESP_LOGW(TAG, "ENC: pattern does not fit channel memory");
+        return RMT_RUN_FAILED;
+    }
 
-        // Использование неблокирующей очереди передач и поддержание небольшого окна пополнения.
-        rmt_transmit_config_t transmit_cfg_nonblocking = {
-            .loop_count = 0,
+    rmt_channel_handle_t ch[3] = { NULL, NULL, NULL };
+    rmt_encoder_handle_t enc[3] = { NULL, NULL, NULL };
+    rmt_sync_manager_handle_t sync = NULL;
+    bool ok = true;
+    for (int i = 0; i < 3 && ok; ++i) {
+        rmt_tx_channel_config_t tx_cfg = {
+            .gpio_num = gpios[i],
+            .clk_src = RMT_CLK_SRC_DEFAULT,
+            .resolution_hz = plan.res_hz,
+            .mem_block_symbols = mem[i],
+            .trans_queue_depth = 1,
+            .intr_priority = 1,
+            .flags = { .invert_out = 0, .with_dma = 0, .io_loop_back = 0, .io_od_mode = 0, .allow_pd = 0, .init_level = 0 }
+        };
+        rmt_copy_encoder_config_t enc_cfg = {};
+        ok = (rmt_new_tx_channel(&tx_cfg, &ch[i]) == ESP_OK) &&
+             (rmt_new_copy_encoder(&enc_cfg, &enc[i]) == ESP_OK) &&
+             (rmt_enable(ch[i]) == ESP_OK);
+    }
+    if (ok) {
+        rmt_sync_manager_config_t sync_cfg = {
+            .tx_channel_array = ch,
+            .array_size = 3,
+        };
+        ok = (rmt_new_sync_manager(&sync_cfg, &sync) == ESP_OK);
+    }
+    if (ok) {
+        rmt_transmit_config_t loop_cfg = {
+            .loop_count = -1,
             .flags = { .eot_level = 0, .queue_nonblocking = 0 }
         };
+        // менеджер синхронизации запускает каналы одновременно после постановки всех трех
+        for (int i = 0; i < 3 && ok; ++i) {
+            ok = (rmt_transmit(ch[i], enc[i], pat[i], counts[i] * sizeof(rmt_symbol_word_t), &loop_cfg) == ESP_OK);
+        }
+    }
 
-        // Регистрация callback-функции завершения передачи для уведомления об окончании транзакции
-        rmt_tx_event_callbacks_t tx_cbs = {
-            .on_trans_done = rmt_tx_done_cb,
-        };
-        rmt_tx_register_event_callbacks(g_rmt_channel, &tx_cbs, NULL);
+    rmt_run_result_t result = RMT_RUN_FAILED;
+    if (ok) {
+        ESP_LOGI(TAG, "ENC: %d lines, dir=%d, res=%u Hz, quarter=%u ticks, err=%u ppb",
+                 cfg->lines, cfg->dir, (unsigned)plan.res_hz, (unsigned)plan.quarter, (unsigned)plan.err_ppb);
+        while (1) {
+            uint32_t notif_val = 0;
+            xTaskNotifyWait(0, 0xFFFFFFFF, &notif_val, portMAX_DELAY);
+            if (notif_val & RMT_NOTIFY_RECONFIG) break;
+        }
+        result = RMT_RUN_RECONFIG;
+    } else {
+        ESP_LOGE(TAG, "ENC: channel setup failed");
+    }
 
-        int queued = 0;
-        esp_err_t terr = ESP_OK;
-        int initial_queue = RMT_TX_KEEP_QUEUED;
-        if (initial_queue > RMT_TX_QUEUE_DEPTH) initial_queue = RMT_TX_QUEUE_DEPTH;
-        for (int q = 0; q < initial_queue; ++q) {
-            terr = rmt_transmit(g_rmt_channel, g_rmt_copy_encoder, items, idx * sizeof(rmt_symbol_word_t), &transmit_cfg_nonblocking);
-            if (terr != ESP_OK) {
-                ESP_LOGW(TAG, "RMT: initial transmit queue failed at slot %d (%d)", q, terr);
-                break;
-            }
-            queued++;
+    // отключение канала прерывает бесконечный цикл передачи
+    if (sync) rmt_del_sync_manager(sync);
+    for (int i = 0; i < 3; ++i) {
+        if (ch[i]) {
+            rmt_disable(ch[i]);
+            rmt_del_channel(ch[i]);
         }
-        if (queued == 0) {
-            free(items);
+        if (enc[i]) rmt_del_encoder(enc[i]);
+        gpio_set_level(gpios[i], 0);
+        gpio_set_direction(gpios[i], GPIO_MODE_OUTPUT);
+    }
+    g_enc_res_hz = 0;
+    g_enc_err_ppb = 0;
+    return result;
+}
+
+// Пауза перестройки до момента until (выход в нуле). Возвращает false, если во время
+// паузы пришел новый запрос: снимок берется заново, срок паузы не продлевается.
+static bool rmt_settle_wait(int64_t until)
+{
+    while (1) {
+        int64_t left_us = until - esp_timer_get_time();
+        if (left_us <= 0) return true;
+        uint32_t notif_val = 0;
+        xTaskNotifyWait(0, RMT_NOTIFY_RECONFIG, &notif_val, pdMS_TO_TICKS((uint32_t)((left_us + 999) / 1000)) + 1);
+        if (notif_val & RMT_NOTIFY_RECONFIG) return false;
+    }
+}
+
+static void rmt_tx_task(void *arg)
+{
+    // Локальная копия программы секвенсора: загрузка новой программы не меняет работающую
+    static seq_insn_t seq_prog[SEQ_MAX_INSNS];
+    int64_t settle_until = 0; // конец паузы перестройки (0 — паузы нет)
+
+    // RMT уже настроен/установлен в init_pwm_from_globals
+    while (1) {
+        if (!g_use_rmt) {
             vTaskDelay(pdMS_TO_TICKS(100));
             continue;
         }
 
-        // Цикл пополнения: ожидание уведомлений от callback-функции завершения или бита изменения конфигурации
-        bool reconfigure_requested = false;
-        while (1) {
+        // Снимок ниже учитывает все запросы, накопившиеся за время прошлого прогона, —
+        // отложенный бит перенастройки не должен вызвать повторную пересборку
+        ulTaskNotifyValueClear(NULL, RMT_NOTIFY_RECONFIG);
+
+        // Атомарное копирование параметров в локальные переменные
+        rmt_snapshot_t snap;
+        rmt_take_snapshot(&snap, seq_prog);
+        frame_key_t key = snap.key;
+        uint16_t seq_len = snap.seq_len;
+        bool follow = snap.follow;
+        follow_cfg_t follow_cfg = snap.follow_cfg;
+        bool enc = snap.enc;
+        enc_cfg_t enc_cfg = snap.enc_cfg;
+
+        if (!snap.enabled) {
+            // Если отключено, убеждаемся, что канал остановлен и GPIO в низком уровне
+            rmt_teardown_channel(true);
+            settle_until = 0;
+            g_rmt_settling = false;
+            // Ожидание уведомления об изменении конфигурации
             uint32_t notif_val = 0;
-            // Ожидание либо завершения передачи (notify give увеличивает счетчик), либо обновления конфигурации (установлен старший бит)
-            xTaskNotifyWait(0, 0xFFFFFFFF, &notif_val, portMAX_DELAY);
+            xTaskNotifyWait(0, 0xFFFFFFFF, &notif_val, pdMS_TO_TICKS(500));
+            continue;
+        }
 
-            // Если установлен бит изменения конфигурации, прерываем для пересборки с новыми параметрами
-            if (notif_val & 0x80000000) {
-                reconfigure_requested = true;
-                break;
-            }
+        // Даем выходной линии время успокоиться перед включением перестроенной частоты.
+        // Версия снимка уже опубликована (g_cfg_applied), выход пока остается в нуле.
+        if (settle_until > 0) {
+            g_rmt_settling = true;
+            if (!rmt_settle_wait(settle_until)) continue;
+            settle_until = 0;
+            g_rmt_settling = false;
+        }
 
-            // младшие биты содержат количество завершенных транзакций
-            uint32_t completed = notif_val & 0x7FFFFFFF;
-            for (uint32_t c = 0; c < completed; ++c) {
-                // попытка поставить в очередь один новый кадр, чтобы очередь была полной
-                esp_err_t terr2 = rmt_transmit(g_rmt_channel, g_rmt_copy_encoder, items, idx * sizeof(rmt_symbol_word_t), &transmit_cfg_nonblocking);
-                if (terr2 != ESP_OK) {
-                    // если очередь полна или ошибка, просто прерываем; следующий callback уведомит снова
-                    break;
+        // Энкодер работает на собственных каналах без DMA; основной канал освобождается
+        if (enc) {
+            rmt_teardown_channel(true);
+            if (rmt_run_encoder(&enc_cfg, key.rpm_milli) == RMT_RUN_RECONFIG) {
+                settle_until = esp_timer_get_time() + (int64_t)RMT_REBUILD_DELAY_MS * 1000;
+            } else {
+                // Повтор с теми же настройками дал бы тот же отказ: ждем новых настроек
+                uint32_t notif_val = 0;
+                while (!(notif_val & RMT_NOTIFY_RECONFIG)) {
+                    xTaskNotifyWait(0, RMT_NOTIFY_RECONFIG, &notif_val, portMAX_DELAY);
                 }
-                // очередь поддерживается примерно постоянной
             }
+            continue;
         }
 
-        // Запрошено изменение конфигурации: попытка кратковременного сброса, затем отключение канала
-        rmt_tx_wait_all_done(g_rmt_channel, pdMS_TO_TICKS(50));
+        // Разрешение канала: для равномерного кадра — по плану кадра, иначе тик 1 мкс.
+        // Канал с другим разрешением пересоздается.
+        uint32_t res_hz = RMT_DEFAULT_RESOLUTION_HZ;
+        rmt_frame_plan_t plan;
+        if (!follow && seq_len == 0 && rmt_plan_frame(&key, &plan)) res_hz = plan.res_hz;
+        if (g_rmt_channel && g_rmt_channel_res_hz != res_hz) rmt_teardown_channel(true);
+        g_rmt_resolution_hz = res_hz;
 
-        // Отключение и удаление канала для полного освобождения управления GPIO
-        rmt_disable(g_rmt_channel);
-        rmt_del_channel(g_rmt_channel);
-        g_rmt_channel = NULL;
-        if (g_rmt_copy_encoder) {
-            rmt_del_encoder(g_rmt_copy_encoder);
-            g_rmt_copy_encoder = NULL;
+        // Убеждаемся, что канал существует (на случай, если он был удален при перенастройке)
+        if (!g_rmt_channel) {
+            init_pwm_from_globals();
+            if (!g_rmt_channel) {
+                vTaskDelay(pdMS_TO_TICKS(100));
+                continue;
+            }
         }
 
-        // Принудительная установка GPIO в низкий уровень для предотвращения плавающего состояния/глюков во время перенастройки
-        gpio_set_level(SLOW_PWM, 0);
-        gpio_set_direction(SLOW_PWM, GPIO_MODE_OUTPUT);
-
-        free(items);
+        // Канал может быть отключен после обновления конфигурации; убеждаемся, что TX включен.
+        esp_err_t en_err = rmt_enable(g_rmt_channel);
+        if (en_err != ESP_OK && en_err != ESP_ERR_INVALID_STATE) {
+            ESP_LOGE(TAG, "RMT: enable failed (%d)", en_err);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
 
-        // Даем выходной линии время успокоиться перед включением перестроенной частоты.
-        if (reconfigure_requested) {
-            vTaskDelay(pdMS_TO_TICKS(RMT_REBUILD_DELAY_MS));
+        rmt_run_result_t result;
+        if (follow) {
+            result = rmt_run_follow(&follow_cfg, key.pulses, key.pulse_pct);
+        } else if (seq_len > 0) {
+            result = rmt_run_sequencer(seq_prog, seq_len);
+        } else {
+            result = rmt_run_frame(&key);
+        }
+        if (result == RMT_RUN_FAILED) {
+            continue;
         }
 
-        // Повторная инициализация канала RMT (это перенастроит GPIO на функцию RMT)
-        init_pwm_from_globals();
+        // Пауза перестройки отсчитывается после нового снимка в начале цикла.
+        // После внешнего останова параметры не менялись — сразу снова взводим кадр.
+        if (result == RMT_RUN_RECONFIG) {
+            settle_until = esp_timer_get_time() + (int64_t)RMT_REBUILD_DELAY_MS * 1000;
+        }
+        // Канал пересоздается в начале цикла с разрешением новой конфигурации
+        // (это перенастроит GPIO на функцию RMT)
     }
 }
 
@@ -780,7 +2829,7 @@ static esp_err_t load_settings(void)
 
     uint32_t pulse = 0;
     uint32_t pause = 0;
-    if (compute_pulse_timing(g_pulses_per_rev, g_rpm, g_pulse_percent, &pulse, &pause, NULL, NULL)) {
+    if (compute_pulse_timing(g_pulses_per_rev, g_rpm_milli, g_pulse_percent, &pulse, &pause, NULL, NULL)) {
         g_pulse_us = pulse;
         g_pause_us = pause;
     }
@@ -791,12 +2840,7 @@ static esp_err_t load_settings(void)
     }
     if (g_param_lock) {
         if (xSemaphoreTake(g_param_lock, pdMS_TO_TICKS(50)) == pdTRUE) {
-            g_params.pulses_per_rev = g_pulses_per_rev;
-            g_params.pulse_us = g_pulse_us;
-            g_params.pause_us = g_pause_us;
-            g_params.pulse_pct = g_pulse_percent;
-            g_params.rpm = g_rpm;
-            g_params.enabled = g_output_enabled;
+            params_copy_from_globals();
             xSemaphoreGive(g_param_lock);
         }
     }
@@ -863,6 +2907,38 @@ static httpd_handle_t start_webserver(void)
     };
     httpd_register_uri_handler(server, &status_get);
 
+    httpd_uri_t program_post = {
+        .uri = "/program",
+        .method = HTTP_POST,
+        .handler = program_post_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(server, &program_post);
+
+    httpd_uri_t preset_post = {
+        .uri = "/preset",
+        .method = HTTP_POST,
+        .handler = preset_post_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(server, &preset_post);
+
+    httpd_uri_t presets_get = {
+        .uri = "/presets",
+        .method = HTTP_GET,
+        .handler = presets_get_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(server, &presets_get);
+
+    httpd_uri_t frame_get = {
+        .uri = "/frame",
+        .method = HTTP_GET,
+        .handler = frame_get_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(server, &frame_get);
+
     ESP_LOGI(TAG, "HTTP server started");
     return server;
 }
@@ -898,6 +2974,163 @@ static void wifi_init_softap(void)
     ESP_LOGI(TAG, "softAP started SSID:%s password:%s", AP_SSID, AP_PASS);
 }
 
+static void con_send(uint8_t cmd, const uint8_t *payload, uint8_t len)
+{
+    uint8_t frame[CON_MAX_PAYLOAD + CON_FRAME_OVERHEAD];
+    size_t n = con_frame_build(frame, cmd, payload, len);
+    usb_serial_jtag_write_bytes(frame, n, pdMS_TO_TICKS(20));
+}
+
+static void con_send_nak(uint8_t err)
+{
+    con_send(CON_RSP_NAK, &err, 1);
+}
+
+// Статус (LE): enabled, pulses, pulse_pct, trig (u8); rpm_milli, freq_mhz, in_freq_mhz,
+// cfg_ver, cfg_applied, underruns, trig_count, frame_ver, uptime_ms (u32)
+static void con_send_status(void)
+{
+    uint8_t st[CON_STATUS_LEN];
+    uint32_t rpm_milli = g_rpm_milli;
+    st[0] = g_output_enabled ? 1 : 0;
+    st[1] = (uint8_t)g_pulses_per_rev;
+    st[2] = (uint8_t)g_pulse_percent;
+    st[3] = (uint8_t)g_trig_mode;
+    con_put_u32(&st[4], rpm_milli);
+    con_put_u32(&st[8], (rpm_milli * (uint32_t)g_pulses_per_rev + 30U) / 60U);
+    con_put_u32(&st[12], cap_input_freq_mhz());
+    con_put_u32(&st[16], g_cfg_requested);
+    con_put_u32(&st[20], g_cfg_applied);
+    con_put_u32(&st[24], g_rmt_underruns);
+    con_put_u32(&st[28], g_trig_count);
+    con_put_u32(&st[32], g_frame_version);
+    con_put_u32(&st[36], (uint32_t)(esp_timer_get_time() / 1000));
+    con_send(CON_CMD_STATUS | CON_RSP_FLAG, st, sizeof(st));
+}
+
+// Обработка принятого кадра. SET (LE): pulses, pulse_pct, enabled, trig (u8); rpm_milli u32;
+// fast_freq u32; fast_pct, fast_enabled, follow, in_teeth, mul, div (u8); в расширенной форме
+// (CON_SET_ENC_LEN) дальше enc u8, enc_lines u16, enc_dir u8, иначе энкодер не меняется.
+// Настройки применяются сразу, без окна объединения запросов HTTP: снимок берется за
+// доли миллисекунды, но выход после пересоздания канала по-прежнему выдерживает паузу
+// RMT_REBUILD_DELAY_MS (без нее обходится только подмена кадра из кэша).
+static void con_handle(const con_parser_t *p, uint32_t *stream_ms)
+{
+    switch (p->cmd) {
+    case CON_CMD_PING:
+        con_send(CON_CMD_PING | CON_RSP_FLAG, NULL, 0);
+        break;
+    case CON_CMD_SET: {
+        if (p->len != CON_SET_LEN && p->len != CON_SET_ENC_LEN) {
+            con_send_nak(CON_ERR_LEN);
+            break;
+        }
+        const uint8_t *d = p->payload;
+        gen_settings_t st = {
+            .pulses_per_rev = d[0],
+            .pulse_pct = d[1],
+            .enabled = (d[2] != 0),
+            .trig_mode = d[3],
+            .rpm_milli = con_get_u32(&d[4]),
+            .fast_freq = con_get_u32(&d[8]),
+            .fast_pct = d[12],
+            .fast_enabled = (d[13] != 0),
+            .follow = (d[14] != 0),
+            .follow_cfg = { .in_teeth = d[15], .mul = d[16], .div = d[17] },
+            .enc = g_enc_enabled,
+            .enc_cfg = g_enc,
+        };
+        if (p->len == CON_SET_ENC_LEN) {
+            st.enc = (d[18] != 0);
+            st.enc_cfg.lines = (int)((uint32_t)d[19] | ((uint32_t)d[20] << 8));
+            st.enc_cfg.dir = d[21];
+        }
+        uint32_t ticket = apply_settings(&st, true);
+        if (ticket == 0) {
+            con_send_nak(CON_ERR_PARAM);
+            break;
+        }
+        uint8_t rsp[4];
+        con_put_u32(rsp, ticket);
+        con_send(CON_CMD_SET | CON_RSP_FLAG, rsp, sizeof(rsp));
+        break;
+    }
+    case CON_CMD_STATUS:
+        con_send_status();
+        break;
+    case CON_CMD_STREAM: {
+        if (p->len != 2) {
+            con_send_nak(CON_ERR_LEN);
+            break;
+        }
+        uint32_t ms = (uint32_t)p->payload[0] | ((uint32_t)p->payload[1] << 8);
+        if (ms > 0 && ms < CON_STREAM_MIN_MS) ms = CON_STREAM_MIN_MS;
+        *stream_ms = ms;
+        con_send(CON_CMD_STREAM | CON_RSP_FLAG, p->payload, 2);
+        break;
+    }
+    default:
+        con_send_nak(CON_ERR_CMD);
+        break;
+    }
+}
+
+// Задача консоли: чтение возвращается сразу при поступлении байтов, поэтому команда
+// применяется без ожидания таймаута; между командами отправляется поток статуса.
+static void console_task(void *arg)
+{
+    static con_parser_t parser;
+    uint8_t rx[64];
+    uint32_t stream_ms = 0;
+    int64_t next_stream_us = 0;
+
+    while (1) {
+        TickType_t wait = pdMS_TO_TICKS(CON_POLL_MS);
+        if (stream_ms > 0) {
+            int64_t left_us = next_stream_us - esp_timer_get_time();
+            TickType_t left = (left_us > 0) ? pdMS_TO_TICKS((uint32_t)(left_us / 1000)) : 0;
+            if (left < wait) wait = (left > 0) ? left : 1;
+        }
+
+        int n = usb_serial_jtag_read_bytes(rx, sizeof(rx), wait);
+        for (int i = 0; i < n; ++i) {
+            int r = con_parser_feed(&parser, rx[i]);
+            if (r > 0) {
+                uint32_t prev = stream_ms;
+                con_handle(&parser, &stream_ms);
+                if (stream_ms != prev) next_stream_us = esp_timer_get_time();
+            } else if (r < 0) {
+                con_send_nak(CON_ERR_CRC);
+            }
+        }
+
+        if (stream_ms > 0 && esp_timer_get_time() >= next_stream_us) {
+            con_send_status();
+            next_stream_us += (int64_t)stream_ms * 1000;
+            // после долгой блокировки записи не догоняем пропущенные кадры пачкой
+            if (next_stream_us < esp_timer_get_time()) next_stream_us = esp_timer_get_time() + (int64_t)stream_ms * 1000;
+        }
+    }
+}
+
+static void console_init(void)
+{
+    usb_serial_jtag_driver_config_t cfg = USB_SERIAL_JTAG_DRIVER_CONFIG_DEFAULT();
+    esp_err_t err = usb_serial_jtag_driver_install(&cfg);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Console: USB-Serial-JTAG driver install failed (%d)", err);
+        return;
+    }
+    // Журнал (stdout) переключается на драйвер: иначе ESP_LOG пишет прямо в FIFO
+    // параллельно передаче драйвера по прерываниям, и текст попадает внутрь кадров
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+    usb_serial_jtag_vfs_use_driver();
+#else
+    esp_vfs_usb_serial_jtag_use_driver();
+#endif
+    xTaskCreatePinnedToCore(console_task, "console", 4096, NULL, 5, NULL, 0);
+}
+
 void app_main(void)
 {
     esp_err_t err = nvs_flash_init();
@@ -907,13 +3140,24 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(err);
 
+    // Планировщик перенастройки нужен до того, как начнут приходить запросы
+    reconfig_init();
+    // Блокировка кэша кадров: им пользуются задача RMT и обработчик /preset
+    g_frame_cache_lock = xSemaphoreCreateMutex();
+
     // Создание задачи инициализации сети, привязанной к ядру 0
     xTaskCreatePinnedToCore(network_task, "net_init", 4096, NULL, 5, NULL, 0);
 
     // Инициализация аппаратного ШИМ (запускает/создает задачу RMT, привязанную к ядру 1)
     init_pwm_from_globals();
+    // Вход внешнего запуска (активен только при trig != 0)
+    trig_init();
+    // Захват входного сигнала для режима слежения
+    cap_init();
     // Инициализация быстрого ШИМ LEDC
     init_fast_pwm();
+    // Бинарная консоль USB-Serial-JTAG — управление без Wi-Fi
+    console_init();
 
     ESP_LOGI(TAG, "Application started. Connect to SSID '%s' and open http://192.168.4.1/", AP_SSID);
 }
@@ -0,0 +1,211 @@
+#include <string.h>
+
+#include "seq_vm.h"
+
+bool seq_program_decode(const uint8_t *buf, size_t n, seq_insn_t *out, uint16_t *out_len)
+{
+    if (!buf || !out || !out_len) return false;
+    if (n % SEQ_INSN_WIRE_SIZE != 0) return false;
+    size_t count = n / SEQ_INSN_WIRE_SIZE;
+    if (count > SEQ_MAX_INSNS) return false;
+
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *p = buf + i * SEQ_INSN_WIRE_SIZE;
+        out[i].op = p[0];
+        out[i].n = p[1];
+        out[i].a = (uint16_t)(p[2] | (p[3] << 8));
+        out[i].d0 = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+        out[i].d1 = (uint32_t)p[8] | ((uint32_t)p[9] << 8) | ((uint32_t)p[10] << 16) | ((uint32_t)p[11] << 24);
+    }
+    *out_len = (uint16_t)count;
+    return true;
+}
+
+// Проверка программы перед загрузкой: известные коды, корректные длительности,
+// сбалансированные LOOP/NEXT и условные блоки, не разрывающие циклы.
+bool seq_program_validate(const seq_insn_t *prog, uint16_t len, const char **out_err)
+{
+    const char *err = NULL;
+    int depth = 0;
+    bool emits = false;
+
+    for (uint16_t i = 0; i < len && !err; ++i) {
+        const seq_insn_t *in = &prog[i];
+        switch (in->op) {
+        case SEQ_OP_END:
+        case SEQ_OP_DROP:
+        case SEQ_OP_HALT:
+            break;
+        case SEQ_OP_HIGH:
+        case SEQ_OP_LOW:
+            if (in->d0 == 0 || in->d0 > SEQ_MAX_DURATION_US) err = "bad duration";
+            emits = true;
+            break;
+        case SEQ_OP_TOOTH:
+            if (in->d0 == 0 || in->d1 == 0 || in->d0 > SEQ_MAX_DURATION_US || in->d1 > SEQ_MAX_DURATION_US) err = "bad duration";
+            emits = true;
+            break;
+        case SEQ_OP_LOOP:
+            if (in->d0 == 0) err = "bad loop count";
+            if (++depth > SEQ_LOOP_DEPTH) err = "loops too deep";
+            break;
+        case SEQ_OP_NEXT:
+            if (--depth < 0) err = "unmatched next";
+            break;
+        case SEQ_OP_WHEN_REV:
+        case SEQ_OP_WHEN_TOOTH: {
+            if (in->op == SEQ_OP_WHEN_REV && (in->a == 0 || in->d0 >= in->a)) {
+                err = "bad rev condition";
+                break;
+            }
+            if (in->n == 0 || (uint32_t)i + in->n >= len) {
+                err = "bad skip length";
+                break;
+            }
+            // Пропускаемый блок не должен входить в цикл или выходить из него
+            int inner = 0;
+            for (uint16_t k = i + 1; k <= i + in->n; ++k) {
+                if (prog[k].op == SEQ_OP_LOOP) inner++;
+                if (prog[k].op == SEQ_OP_NEXT && --inner < 0) break;
+            }
+            if (inner != 0) err = "skip crosses loop";
+            break;
+        }
+        default:
+            err = "unknown op";
+            break;
+        }
+    }
+    if (!err && depth != 0) err = "unterminated loop";
+    if (!err && !emits) err = "program emits nothing";
+
+    if (out_err) *out_err = err;
+    return err == NULL;
+}
+
+void seq_vm_reset(seq_vm_t *vm, const seq_insn_t *prog, uint16_t len)
+{
+    memset(vm, 0, sizeof(*vm));
+    vm->prog = prog;
+    vm->len = len;
+}
+
+static void seq_vm_push(seq_vm_t *vm, uint32_t level, uint32_t duration)
+{
+    uint8_t slot = (uint8_t)((vm->pend_head + vm->pend_count) % 2);
+    vm->pend[slot].level = level;
+    vm->pend[slot].left = duration;
+    vm->pend_count++;
+}
+
+// Выполнение одной инструкции. Сегменты вывода помещаются в очередь pend.
+static void seq_vm_step(seq_vm_t *vm)
+{
+    if (vm->pc >= vm->len) {
+        // неявный END в конце программы
+        vm->pc = 0;
+        vm->sp = 0;
+        vm->tooth = 0;
+        vm->drop_next = false;
+        vm->rev++;
+        return;
+    }
+
+    const seq_insn_t *in = &vm->prog[vm->pc++];
+    switch (in->op) {
+    case SEQ_OP_END:
+        vm->pc = vm->len;
+        break;
+    case SEQ_OP_HIGH:
+        seq_vm_push(vm, 1, in->d0);
+        break;
+    case SEQ_OP_LOW:
+        seq_vm_push(vm, 0, in->d0);
+        break;
+    case SEQ_OP_TOOTH:
+        if (vm->drop_next) {
+            // пропуск зуба: весь период остается в низком уровне
+            seq_vm_push(vm, 0, in->d0 + in->d1);
+            vm->drop_next = false;
+        } else {
+            seq_vm_push(vm, 1, in->d0);
+            seq_vm_push(vm, 0, in->d1);
+        }
+        vm->tooth++;
+        break;
+    case SEQ_OP_DROP:
+        vm->drop_next = true;
+        break;
+    case SEQ_OP_LOOP:
+        vm->loops[vm->sp].start = vm->pc;
+        vm->loops[vm->sp].left = in->d0;
+        vm->sp++;
+        break;
+    case SEQ_OP_NEXT:
+        if (vm->sp > 0 && --vm->loops[vm->sp - 1].left > 0) {
+            vm->pc = vm->loops[vm->sp - 1].start;
+        } else if (vm->sp > 0) {
+            vm->sp--;
+        }
+        break;
+    case SEQ_OP_WHEN_REV:
+        if ((vm->rev % in->a) != in->d0) vm->pc += in->n;
+        break;
+    case SEQ_OP_WHEN_TOOTH:
+        if (vm->tooth != in->a) vm->pc += in->n;
+        break;
+    case SEQ_OP_HALT:
+        vm->end = SEQ_END_HALT;
+        break;
+    default:
+        break;
+    }
+}
+
+// Заполнение блока символов. Возвращает количество символов; незаконченный сегмент
+// переносится в следующий вызов, поэтому блоки стыкуются без разрывов. Когда программа
+// заканчивается (HALT или SEQ_STEP_BUDGET шагов без вывода), выводится остаток сегментов,
+// vm->end получает причину, а последующие вызовы возвращают 0 до seq_vm_reset.
+uint32_t seq_vm_fill(seq_vm_t *vm, uint32_t *words, uint32_t cap)
+{
+    uint32_t idx = 0;
+    uint32_t level0 = 0;
+    uint32_t duration0 = 0;
+    bool half = false;
+    uint32_t idle_steps = 0;
+
+    while (idx < cap) {
+        if (vm->pend_count == 0) {
+            if (vm->end != SEQ_END_NONE) break;
+            if (++idle_steps > SEQ_STEP_BUDGET) {
+                vm->end = SEQ_END_STALL;
+                break;
+            }
+            seq_vm_step(vm);
+            continue;
+        }
+        idle_steps = 0;
+
+        seq_segment_t *seg = &vm->pend[vm->pend_head];
+        uint32_t piece = (seg->left > SEQ_SYMBOL_MAX_DURATION) ? SEQ_SYMBOL_MAX_DURATION : seg->left;
+        seg->left -= piece;
+        if (!half) {
+            level0 = seg->level;
+            duration0 = piece;
+            half = true;
+        } else {
+            words[idx++] = SEQ_SYMBOL(level0, duration0, seg->level, piece);
+            half = false;
+        }
+        if (seg->left == 0) {
+            vm->pend_head = (uint8_t)((vm->pend_head + 1) % 2);
+            vm->pend_count--;
+        }
+    }
+
+    if (half) {
+        // Программа закончилась посреди символа: закрываем его как в rmt_builder_finalize
+        words[idx++] = SEQ_SYMBOL(level0, duration0, 0, 0);
+    }
+    return idx;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+// Секвенсор: байткод, описывающий оборот по зубьям (ширина импульса, паузы,
+// уровни, циклы и условия), и его интерпретатор. Интерпретатор выдает символы
+// в формате слова RMT (rmt_symbol_word_t) и не зависит от ESP-IDF, поэтому
+// собирается и на хосте (host/seq_bench.c).
+//
+// Формат инструкции на проводе: 12 байт little-endian
+//   [0] op  [1] n  [2..3] a  [4..7] d0  [8..11] d1
+// Длительности в микросекундах (тик RMT 1 мкс).
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEQ_MAX_INSNS 64 // макс. инструкций в программе
+#define SEQ_INSN_WIRE_SIZE 12 // размер инструкции в загружаемом образе (байт)
+#define SEQ_LOOP_DEPTH 4 // макс. вложенность циклов
+#define SEQ_STEP_BUDGET 1024 // макс. шагов без вывода, после них программа считается остановившейся
+#define SEQ_MAX_DURATION_US 60000000 // макс. длительность сегмента инструкции (60 с)
+#define SEQ_SYMBOL_MAX_DURATION 32767 // макс. длительность половины символа (15 бит)
+
+// Слово символа: duration0[14:0] level0[15] duration1[30:16] level1[31], как rmt_symbol_word_t
+#define SEQ_SYMBOL(l0, d0, l1, d1) \
+    ((uint32_t)(d0) | ((uint32_t)(l0) << 15) | ((uint32_t)(d1) << 16) | ((uint32_t)(l1) << 31))
+
+typedef enum {
+    SEQ_OP_END = 0,     // конец оборота: rev++, tooth = 0, переход в начало
+    SEQ_OP_HIGH,        // высокий уровень d0 мкс
+    SEQ_OP_LOW,         // низкий уровень d0 мкс
+    SEQ_OP_TOOTH,       // зуб: импульс d0 мкс, пауза d1 мкс; tooth++
+    SEQ_OP_DROP,        // следующий TOOTH выводится низким уровнем (пропуск зуба)
+    SEQ_OP_LOOP,        // повторить тело до NEXT d0 раз
+    SEQ_OP_NEXT,        // конец тела цикла
+    SEQ_OP_WHEN_REV,    // выполнить следующие n инструкций, только если rev % a == d0
+    SEQ_OP_WHEN_TOOTH,  // выполнить следующие n инструкций, только если tooth == a (нумерация с 0)
+    SEQ_OP_HALT,        // останов: вывод заканчивается, линия остается в низком уровне
+} seq_op_t;
+
+// Причина окончания вывода программы
+typedef enum {
+    SEQ_END_NONE = 0,   // программа выполняется
+    SEQ_END_HALT,       // выполнена инструкция HALT
+    SEQ_END_STALL,      // SEQ_STEP_BUDGET шагов подряд без вывода (пустой цикл или условия)
+} seq_end_t;
+
+typedef struct {
+    uint8_t op;
+    uint8_t n;
+    uint16_t a;
+    uint32_t d0;
+    uint32_t d1;
+} seq_insn_t;
+
+typedef struct {
+    uint32_t level;
+    uint32_t left;
+} seq_segment_t;
+
+typedef struct {
+    const seq_insn_t *prog;
+    uint16_t len;
+    uint16_t pc;
+    uint16_t tooth;
+    uint8_t sp;
+    bool drop_next;
+    uint8_t end; // seq_end_t; после окончания seq_vm_fill больше ничего не выдает
+    uint32_t rev;
+    struct {
+        uint16_t start;
+        uint32_t left;
+    } loops[SEQ_LOOP_DEPTH];
+    // очередь сегментов, еще не выведенных в символы (TOOTH дает до двух)
+    seq_segment_t pend[2];
+    uint8_t pend_head;
+    uint8_t pend_count;
+} seq_vm_t;
+
+bool seq_program_decode(const uint8_t *buf, size_t n, seq_insn_t *out, uint16_t *out_len);
+bool seq_program_validate(const seq_insn_t *prog, uint16_t len, const char **out_err);
+void seq_vm_reset(seq_vm_t *vm, const seq_insn_t *prog, uint16_t len);
+uint32_t seq_vm_fill(seq_vm_t *vm, uint32_t *words, uint32_t cap);